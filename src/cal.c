@@ -0,0 +1,100 @@
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ */
+
+#include "cal.h"
+
+#include <avr/eeprom.h>
+
+#include "cdc.h"
+#include "heater.h"
+#include "nvm.h"
+
+typedef struct {
+  uint8_t n;
+  uint8_t t[CAL_POINTS];  // sorted ascending
+  uint8_t d[CAL_POINTS];
+} cal_t;
+
+static cal_t cal;
+static cal_t EEMEM cal_ee;
+static int16_t slope[CAL_POINTS - 1];  // duty per temperature unit, 8.8
+
+static const uint8_t presets[] = CAL_PRESETS;
+static const uint8_t defaults[] = MODEL_PWR_STEPS;
+
+static void cal_apply(void) {
+  uint8_t i;
+  int16_t s;
+
+  for (i = 0; i + 1 < cal.n; i++) {
+    s = ((int16_t)cal.d[i + 1] - cal.d[i]) << 7;  // 9.7 to stay in range
+    s /= cal.t[i + 1] - cal.t[i];
+    slope[i] = s < -0x4000 ? -0x8000 : s > 0x3FFF ? 0x7FFF : s * 2;
+  }
+
+  // Without a calibration, e.g. after '00 k', the model's duty cycles
+  // apply again.
+  for (i = 0; i < sizeof(presets); i++) {
+    pwr_steps[i + 1] = cal_valid() ? cal_duty(presets[i]) : defaults[i + 1];
+  }
+}
+
+void calInit(void) {
+  eeprom_read_block(&cal, &cal_ee, sizeof(cal));
+  if (cal.n > CAL_POINTS) cal.n = 0;  // erased EEPROM
+  cal_apply();
+}
+
+uint8_t cal_record(uint8_t t) {
+  // The duty cycle the heater actually runs, after the current limit and
+  // the compensation, taken back to the nominal supply the presets are for.
+  uint16_t d = ((uint16_t)heater_duty << 8) / heater_factor();
+  uint8_t i, duty = d > 0xFF ? 0xFF : d;
+
+  if (t == 0) {
+    cal.n = 0;
+  } else {
+    for (i = 0; i < cal.n && cal.t[i] < t; i++) {
+    }
+    if (i == cal.n || cal.t[i] != t) {
+      uint8_t j;
+
+      if (cal.n == CAL_POINTS) return 0;
+      for (j = cal.n; j > i; j--) {
+        cal.t[j] = cal.t[j - 1];
+        cal.d[j] = cal.d[j - 1];
+      }
+      cal.n++;
+    }
+    cal.t[i] = t;
+    cal.d[i] = duty;
+  }
+
+  cal_apply();
+  return nvm_write(&cal_ee, &cal, sizeof(cal));
+}
+
+uint8_t cal_point(uint8_t i, uint8_t *t, uint8_t *duty) {
+  if (i >= cal.n) return 0;
+  *t = cal.t[i];
+  *duty = cal.d[i];
+  return 1;
+}
+
+uint8_t cal_valid(void) { return cal.n >= 2; }
+
+uint8_t cal_duty(uint8_t t) {
+  uint8_t i;
+  int32_t d;
+
+  // Segment below t, the outer segments extrapolate.
+  for (i = 0; i + 2 < cal.n && t >= cal.t[i + 1]; i++) {
+  }
+
+  d = ((int32_t)((int16_t)t - cal.t[i]) * slope[i] + 0x80) >> 8;
+  d += cal.d[i];
+  return d < 0 ? 0 : d > 0xFF ? 0xFF : d;
+}
@@ -0,0 +1,49 @@
+#ifndef __CAL_H__
+#define __CAL_H__
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * Per-unit temperature calibration.
+ *
+ * Up to CAL_POINTS pairs of tip temperature and the duty cycle that holds
+ * it are recorded from the serial interface and kept in EEPROM. With at
+ * least two points, temperatures are converted to duty cycles by piecewise
+ * linear interpolation (extrapolating beyond the outer points) and the
+ * presets are set from CAL_PRESETS of the model descriptor.
+ *
+ * Temperatures are given in units of 2 degrees C so they fit a single
+ * command byte (0..510 C). The slope of every segment is precomputed in
+ * 8.8 fixed point, so a conversion is a scan over at most CAL_POINTS
+ * entries plus one 16 x 16 bit multiplication into 32 bits, without any
+ * division. The ATtiny85 has no MUL instruction, so that is a libgcc call;
+ * the build reports the cycles of cal_duty() without it.
+ */
+
+#include <stdint.h>
+
+#include "model.h"
+
+#define CAL_POINTS 6
+
+// Record the effective duty cycle (heater_duty at HEATER_NOMINAL_MV) as the
+// one holding temperature 't'.
+// A point with the same temperature is replaced, 't' == 0 clears all
+// points. Returns 0 if all points are in use or the points couldn't be
+// queued for the EEPROM; they are applied but not saved then.
+uint8_t cal_record(uint8_t t);
+
+// Read point 'i'. Returns 0 if there is no such point.
+uint8_t cal_point(uint8_t i, uint8_t *t, uint8_t *duty);
+
+// Returns 1 if enough points were recorded for cal_duty().
+uint8_t cal_valid(void);
+
+// Duty cycle that holds temperature 't'.
+uint8_t cal_duty(uint8_t t);
+
+// Load the points from EEPROM and apply them to the presets.
+void calInit(void);
+
+#endif  // __CAL_H__
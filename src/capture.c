@@ -0,0 +1,144 @@
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ */
+
+#include "capture.h"
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+#include "sensor.h"
+
+#define CAPTURE_MSK (CAPTURE_LEN - 1)
+
+uint8_t capture_rate = 1;
+uint8_t capture_level = 0x80;
+
+static uint8_t buf[CAPTURE_LEN];
+static volatile uint8_t head;     // next slot to write
+static volatile uint8_t stored;   // valid samples, saturates at CAPTURE_LEN
+static volatile uint8_t state;
+static volatile uint8_t post;     // samples left after the trigger
+static volatile uint8_t trig_at;  // samples stored when the trigger fired
+static uint8_t mask;
+static uint8_t div;
+
+static uint8_t pos, left, prev;  // dump progress
+
+static void capture_stop(void) {
+  ADCSRA &= ~((1 << ADATE) | (1 << ADIE));
+  ADMUX = SENSOR_MUX;
+  ADCSRA |= (1 << ADIF) | (1 << ADSC);  // clear flag, resume sensor sampling
+}
+
+// Called with interrupts disabled.
+static void capture_fire(void) {
+  state = CAPTURE_TRIGGERED;
+  post = CAPTURE_POST;
+  trig_at = stored;
+}
+
+ISR(ADC_vect, ISR_NOBLOCK) {
+  uint8_t s = ADCH;
+
+  if (--div) return;
+  div = capture_rate;
+
+  if (state == CAPTURE_ARMED) {
+    uint8_t last = buf[(head - 1) & CAPTURE_MSK];
+
+    if (stored && (((mask & CAPTURE_TRIG_RISING) && last <= capture_level &&
+                    s > capture_level) ||
+                   ((mask & CAPTURE_TRIG_FALLING) && last >= capture_level &&
+                    s < capture_level))) {
+      capture_fire();
+    }
+  }
+
+  buf[head] = s;
+  head = (head + 1) & CAPTURE_MSK;
+  if (stored < CAPTURE_LEN) {
+    stored++;
+  } else if (state == CAPTURE_TRIGGERED && trig_at) {
+    trig_at--;  // the oldest sample was overwritten
+  }
+
+  if (state == CAPTURE_TRIGGERED && --post == 0) {
+    state = CAPTURE_DONE;
+    capture_stop();
+  }
+}
+
+void capture_arm(uint8_t m) {
+  // Stop a running capture first, ADSC never clears in free running mode.
+  cli();
+  if (capture_busy()) capture_stop();
+  state = CAPTURE_IDLE;
+  sei();
+  if (m == 0) return;  // disarm
+
+  while (ADCSRA & (1 << ADSC)) {
+  }  // let a running sensor conversion finish
+
+  cli();
+  mask = m;
+  head = 0;
+  stored = 0;
+  div = 1;
+  if (capture_rate == 0) capture_rate = 1;
+  state = CAPTURE_ARMED;
+  if (m & CAPTURE_TRIG_NOW) capture_fire();
+  sei();
+
+  ADMUX = SENSOR_MUX | (1 << ADLAR);
+  ADCSRB = 0;  // free running
+  ADCSRA |= (1 << ADIF) | (1 << ADATE) | (1 << ADIE) | (1 << ADSC);
+}
+
+void capture_trigger(uint8_t src) {
+  cli();
+  if (state == CAPTURE_ARMED && (mask & src)) capture_fire();
+  sei();
+}
+
+uint8_t capture_state(void) { return state; }
+
+uint8_t capture_busy(void) {
+  return state == CAPTURE_ARMED || state == CAPTURE_TRIGGERED;
+}
+
+uint8_t capture_dump_start(uint8_t *count, uint8_t *trig) {
+  if (state != CAPTURE_DONE) return 0;
+
+  left = stored;
+  pos = (head - stored) & CAPTURE_MSK;
+  *count = stored;
+  *trig = trig_at;
+  return 1;
+}
+
+uint8_t capture_dump(uint8_t *out, uint8_t max) {
+  uint8_t n = 0;
+  uint16_t v;
+
+  while (left && n + 2 <= max) {
+    if (left == stored) {
+      v = buf[pos];  // first sample is stored as is
+    } else {
+      int16_t d = (int16_t)buf[pos] - prev;
+      v = d < 0 ? ((uint16_t)(-d) << 1) - 1 : (uint16_t)d << 1;
+    }
+    prev = buf[pos];
+    pos = (pos + 1) & CAPTURE_MSK;
+    left--;
+
+    while (v > 0x7F) {
+      out[n++] = (v & 0x7F) | 0x80;
+      v >>= 7;
+    }
+    out[n++] = v;
+  }
+  return n;
+}
@@ -0,0 +1,67 @@
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * Triggered high-rate capture of the sensor input.
+ *
+ * While armed the ADC runs free (clk/128, one sample every 13 ADC clocks
+ * or ~101us) and every 'rate'th sample is stored in a ring of CAPTURE_LEN
+ * bytes (upper 8 bits of the result). When one of the enabled triggers
+ * fires, CAPTURE_POST more samples are stored and the ring is frozen. The
+ * regular sensor sampling pauses while the capture runs.
+ *
+ * The frozen window is dumped as text lines so asynchronous events can be
+ * interleaved safely:
+ *
+ *   =NNRRTT        NN samples, rate RR, trigger at sample TT
+ *   #hhhh...       encoded bytes, repeated
+ *   #              end of dump
+ *
+ * The first sample is stored as is, every following one as the zigzag
+ * encoded difference to its predecessor. Each value is written as a
+ * little-endian base-128 varint. tools/capdump decodes the dump.
+ */
+
+#include <stdint.h>
+
+#define CAPTURE_LEN 64  // must be a power of 2
+#define CAPTURE_POST (CAPTURE_LEN / 2)
+
+#define CAPTURE_TRIG_SETPOINT 0x01
+#define CAPTURE_TRIG_BUTTON 0x02
+#define CAPTURE_TRIG_RISING 0x04   // sample rises above the level
+#define CAPTURE_TRIG_FALLING 0x08  // sample falls below the level
+#define CAPTURE_TRIG_NOW 0x10      // trigger right away
+
+#define CAPTURE_IDLE 0
+#define CAPTURE_ARMED 1
+#define CAPTURE_TRIGGERED 2
+#define CAPTURE_DONE 3
+
+// Sample rate divider and threshold level for the level triggers.
+extern uint8_t capture_rate;
+extern uint8_t capture_level;
+
+// Start sampling, 'mask' selects the triggers. A mask of 0 disarms.
+void capture_arm(uint8_t mask);
+
+// Signal a trigger event (CAPTURE_TRIG_SETPOINT or CAPTURE_TRIG_BUTTON).
+void capture_trigger(uint8_t src);
+
+uint8_t capture_state(void);
+
+// Returns 1 while the capture owns the ADC.
+uint8_t capture_busy(void);
+
+// Start a dump of the frozen window. Returns 0 if nothing was captured.
+uint8_t capture_dump_start(uint8_t *count, uint8_t *trig);
+
+// Encode up to 'max' bytes of the dump into 'out'. Values are never split
+// across calls, 'max' must be at least 2. Returns the number of bytes,
+// 0 at the end of the dump.
+uint8_t capture_dump(uint8_t *out, uint8_t max);
+
+#endif  // __CAPTURE_H__
@@ -10,6 +10,30 @@
 
 #include "cdc.h"
 
+#include <util/crc16.h>
+
+#include "cal.h"
+#include "capture.h"
+#include "heater.h"
+#include "meter.h"
+#include "ram.h"
+#include "reheat.h"
+#include "sched.h"
+#include "sensor.h"
+#include "standby.h"
+#include "timebase.h"
+
+uint8_t pwr_steps[PWR_STEPS_LEN + 2] = MODEL_PWR_STEPS;
+uint8_t pwr_idx;
+uint8_t pwm_phase;
+
+uchar modeBuffer[7];
+uchar sendEmptyFrame;
+uchar intr3Status;
+
+uchar rcnt, twcnt, trcnt;
+char tbuf[TBUF_SZ];
+
 static const PROGMEM char configDescrCDC[] = {
     /* USB configuration descriptor */
     9,               /* sizeof(usbDescrConfig): length of descriptor in bytes */
@@ -147,9 +171,23 @@ uchar usbFunctionWrite(uchar *data, uchar len) {
   return 1;
 }
 
-static uchar val;
-static uint8_t got_val = 0;
+static uchar val, val2;
+static uint8_t got_val = 0;  // number of values received, at most 2
+static uint8_t dumping = 0;
+static uint8_t stats_id;  // next 't' line plus one, 0 when done
+static uint8_t map_id;    // next 'm' module plus one, 0 when done
+static uint8_t watch_periods, watch_cause, watch_tx, detach_periods;
+static uint8_t reattaches, reattach_cause;
+static uint8_t enum_tries;  // enumeration re-attaches since configured
 static char rbuf[8];
+static uint16_t lease_sample;  // sensor_time() of the last 'W' reply
+static uint16_t lease_lat, lease_lat_max;  // ms
+static char rxbuf[RXBUF_SZ];
+static uint8_t rxw, rxr;  // free running ring indices
+static uint16_t rx_packets;  // OUT packets received
+static uint8_t rx_stalls;    // times flow control was asserted
+
+static uchar tx_free(void) { return (trcnt - twcnt - 1) & TBUF_MSK; }
 
 static uchar u2h(uchar u) {
   if (u > 9) u += 7;
@@ -176,6 +214,362 @@ static uint8_t not_hex_digit(uchar d) {
   return 0;
 }
 
+static void out_crlf(void) {
+  out_char('\r');
+  out_char('\n');
+}
+
+static void out_hex8(uchar v) {
+  out_char(u2h(v >> 4));
+  out_char(u2h(v & 0x0f));
+}
+
+static void out_hex16(uint16_t v) {
+  out_hex8(v >> 8);
+  out_hex8(v & 0xff);
+}
+
+// Start the 't' reply, the lines follow from stats_poll() as there is room.
+static void print_task_stats(void) {
+  out_crlf();
+  stats_id = 1;
+}
+
+static void stats_poll(void) {
+  uint16_t max_run;
+  uint8_t id, misses;
+
+  while (stats_id && tx_free() >= 12) {
+    id = stats_id - 1;
+    if (id == SCHED_MAX_TASKS) {
+      id = 0xFE;  // the USB watchdog
+      max_run = reattaches;
+      misses = reattach_cause;
+      stats_id++;
+    } else if (id == SCHED_MAX_TASKS + 1) {
+      id = 0xFF;  // the USB receive callback
+      max_run = rx_packets;
+      misses = rx_stalls;
+      stats_id = 0;
+    } else {
+      stats_id++;
+      if (!sched_stats(id, &max_run, &misses)) continue;
+    }
+    out_hex8(id);
+    out_char(' ');
+    out_hex16(max_run);
+    out_char(' ');
+    out_hex8(misses);
+    out_crlf();
+  }
+}
+
+static void print_idle_stats(void) {
+  uint16_t wakeups, current;
+  uint8_t ratio;
+
+  sched_idle_stats(&wakeups, &ratio, &current);
+  out_crlf();
+  out_hex16(wakeups);
+  out_char(' ');
+  out_hex8(ratio);
+  out_char(' ');
+  out_hex16(current);
+  out_crlf();
+}
+
+static void out_time(uint32_t ms) {
+  out_hex16(ms >> 16);
+  out_hex16(ms & 0xffff);
+}
+
+static void out_event(uchar code, uint16_t val) {
+  out_char('\\');
+  out_char(code);
+  out_hex16(val);
+  out_char('@');
+  out_time(timebase_now());
+  out_crlf();
+}
+
+// Events aren't requested, so nothing guarantees the host reads them. If
+// the ring has no room they are dropped and counted instead of overwriting
+// data that wasn't sent yet; the count goes out with the next event.
+void report_event(uchar code, uint16_t val) {
+  static uint16_t lost;
+
+  if (tx_free() < (lost ? 2 * CDC_EVENT_LEN : CDC_EVENT_LEN)) {
+    if (lost != 0xFFFF) lost++;
+    return;
+  }
+  if (lost) {
+    out_event('L', lost);
+    lost = 0;
+  }
+  out_event(code, val);
+}
+
+static void print_clock(void) {
+  uint32_t ms;
+  uint16_t us;
+
+  ms = timebase_now_us(&us);
+  out_crlf();
+  out_time(ms);
+  out_char(' ');
+  out_hex16(us);
+  out_crlf();
+}
+
+static void print_supply(void) {
+  out_crlf();
+  out_hex16(sensor_vcc());
+  out_char(' ');
+  out_hex16(heater_factor());
+  out_char(' ');
+  out_hex8(heater_duty);
+  out_crlf();
+}
+
+static void print_sample(void) {
+  out_crlf();
+  out_time(timebase_now());
+  out_char(' ');
+  out_hex8(pwr_steps[pwr_idx]);
+  out_char(' ');
+  out_hex16(sensor_read());
+  out_char(' ');
+  out_hex16(sensor_temp());
+  out_crlf();
+}
+
+static void print_capture(void) {
+  out_crlf();
+  out_hex8(capture_state());
+  out_char(' ');
+  out_hex8(capture_rate);
+  out_char(' ');
+  out_hex8(capture_level);
+  out_crlf();
+}
+
+static void start_dump(void) {
+  uint8_t count, trig;
+
+  out_crlf();
+  if (!capture_dump_start(&count, &trig)) {
+    out_char('!');
+    out_crlf();
+    return;
+  }
+  out_char('=');
+  out_hex8(count);
+  out_hex8(capture_rate);
+  out_hex8(trig);
+  out_crlf();
+  dumping = 1;
+}
+
+
+// Continue a capture dump while there is room in the transmit buffer.
+static void dump_poll(void) {
+  uint8_t bytes[CDC_DUMP_LINE], i, n;
+
+  if (!dumping || tx_free() < 2 * CDC_DUMP_LINE + 3) return;
+
+  n = capture_dump(bytes, CDC_DUMP_LINE);
+  out_char('#');
+  for (i = 0; i < n; i++) {
+    out_hex8(bytes[i]);
+  }
+  out_crlf();
+  if (n == 0) dumping = 0;
+}
+
+// CRC-16 of one application page as installed by micronucleus. The reset
+// vector and the tiny table at the end of the last page are patched by the
+// bootloader and left out, see tools/mnflash.c.
+static uint16_t page_crc(uint8_t page) {
+  uint16_t addr = page * SPM_PAGESIZE, end = addr + SPM_PAGESIZE;
+  uint16_t crc = 0xFFFF;
+
+  if (page == 0) addr = 2;
+  if (end == BOOTLOADER_ADDRESS) end -= 4;
+  for (; addr < end; addr++) {
+    crc = _crc16_update(crc, pgm_read_byte(addr));
+  }
+  return crc;
+}
+
+static void print_pages(uint8_t first, uint8_t got) {
+  uint8_t i;
+
+  out_crlf();
+  if (!got) {
+    out_hex8(APP_PAGES);
+    out_char(' ');
+    out_hex8(SPM_PAGESIZE);
+    out_crlf();
+    return;
+  }
+  for (i = first; i < APP_PAGES && i < first + CDC_PAGE_LINE; i++) {
+    if (i != first) out_char(' ');
+    out_hex16(page_crc(i));
+  }
+  out_crlf();
+}
+
+// TIMER0 counts until the duty set now takes effect. While the MOSFET is on
+// that is the next overflow, which may end the on-time. Once it is off it
+// is switched on again only at the start of the next period.
+static uint16_t lease_wait(void) {
+  uint8_t cnt, pos, on;
+  uint16_t wait;
+
+  cli();
+  cnt = TCNT0;
+  pos = heater_pos(timer_counter, pwm_phase);
+  on = pos < heater_duty;
+  sei();
+
+  wait = (uint8_t)(0 - cnt);
+  if (!on) {
+    // Further overflows until the position wraps around.
+    wait += (uint16_t)(((256 - pos + (1 << HEATER_PWM_SHIFT) - 1) >>
+                        HEATER_PWM_SHIFT) - 1) << 8;
+  }
+  return wait;
+}
+
+// 'LL DD W': drive duty DD for LL * 10ms and reply with the reading. While
+// the host keeps renewing the lease, the time from the sample it got with
+// the previous reply until the new duty reaches the heater is its control
+// loop latency.
+static void lease_duty(uint8_t ticks, uint8_t duty) {
+  uint16_t us, lat = 0, wait;
+
+  wait = lease_wait();  // before the new duty changes the MOSFET state
+  if (heater_lease()) {
+    // 64 TIMER0 counts are ~1ms.
+    lat = (uint16_t)timebase_now_us(&us) - lease_sample + (wait >> 6);
+    lease_lat = lat;
+    if (lat > lease_lat_max) lease_lat_max = lat;
+  }
+  standby_reset();
+  heater_set(duty, ticks);
+  lease_sample = sensor_time();
+
+  out_crlf();
+  out_hex16(sensor_read());
+  out_char(' ');
+  out_hex16(sensor_temp());
+  out_char(' ');
+  out_hex16(lat);
+  out_crlf();
+}
+
+static void print_lease(void) {
+  out_crlf();
+  out_hex8(heater_lease());
+  out_char(' ');
+  out_hex8(heater_expiries());
+  out_char(' ');
+  out_hex16(lease_lat);
+  out_char(' ');
+  out_hex16(lease_lat_max);
+  out_crlf();
+}
+
+static void print_cal(void) {
+  uint8_t i, t, duty;
+
+  out_crlf();
+  for (i = 0; cal_point(i, &t, &duty); i++) {
+    out_hex8(t);
+    out_char(' ');
+    out_hex8(duty);
+    out_crlf();
+  }
+}
+
+// 'E': energy in J, then 'minutes heatups' of every preset.
+static void print_meter(void) {
+  const meter_t *m = meter_get();
+  uint8_t i;
+
+  out_crlf();
+  out_time(m->energy);
+  out_crlf();
+  for (i = 0; i < METER_PRESETS; i++) {
+    out_hex16(m->minutes[i]);
+    out_char(' ');
+    out_hex16(m->heatups[i]);
+    out_crlf();
+  }
+}
+
+// 'J': 'joints latency droop droop_max' of the detected joints, latency in
+// ms and droop in 0.1 degrees C, then the parameters 'slope duty boost
+// decay'.
+static void print_reheat(void) {
+  const reheat_t *r = reheat_get();
+  uint8_t i;
+
+  out_crlf();
+  out_hex16(r->joints);
+  out_char(' ');
+  out_hex16(r->latency_ms);
+  out_char(' ');
+  out_hex16(r->droop);
+  out_char(' ');
+  out_hex16(r->droop_max);
+  out_crlf();
+  for (i = 0; i < REHEAT_PARAMS; i++) {
+    if (i) out_char(' ');
+    out_hex8(reheat_param[i]);
+  }
+  out_crlf();
+}
+
+// 'M': 'data bss free lowest' in bytes, the modules follow from map_poll().
+static void print_ram(void) {
+  uint16_t data, bss, free_now, lowest;
+
+  ram_usage(&data, &bss, &free_now, &lowest);
+  out_crlf();
+  out_hex16(data);
+  out_char(' ');
+  out_hex16(bss);
+  out_char(' ');
+  out_hex16(free_now);
+  out_char(' ');
+  out_hex16(lowest);
+  out_crlf();
+  map_id = 1;
+}
+
+// 'name data bss' of every module, names are at most 10 characters.
+static void map_poll(void) {
+  const char *name;
+  uint8_t data, bss;
+  char c;
+
+  while (map_id && tx_free() >= 18) {
+    name = ram_module(map_id - 1, &data, &bss);
+    if (!name) {
+      map_id = 0;
+      break;
+    }
+    map_id++;
+    while ((c = pgm_read_byte(name++)) != 0) out_char(c);
+    out_char(' ');
+    out_hex8(data);
+    out_char(' ');
+    out_hex8(bss);
+    out_crlf();
+  }
+}
+
 static void print_syntax_error() {
   out_char('\r');
   out_char('\n');
@@ -184,92 +578,347 @@ static void print_syntax_error() {
   out_char('\n');
 }
 
-void usbFunctionWriteOut(uchar *data, uchar len) {
-  /*  postpone receiving next data    */
-  usbDisableAllRequests();
-
-  /*    host -> device:  request   */
-  do {
-    char c;
-
-    //    delimiter?
-    c = *data++;
-    out_char(c);
-    if (c > 0x20) {
-      if ('a' <= c && c <= 'z') c -= 0x20;  //    to upper case
-      rbuf[rcnt++] = c;
-      rcnt &= 7;
-      continue;
-    }
-    if (rcnt == 0) continue;
-
-    //    command
-    if (rcnt == 1) {
-      const char *ptr;
-
-      switch (rbuf[0]) {
-        case '?':  //    who
-          ptr = PSTR(CMD_WHO);
-          out_char('\r');
-          out_char('\n');
-          while ((c = pgm_read_byte(ptr++)) != 0) {
-            out_char(c);
-          }
-          out_char('\r');
-          out_char('\n');
-          break;
-        case 'G':  //    get
-          out_char('\r');
-          out_char('\n');
-          out_char(u2h(pwr_steps[pwr_idx] >> 4));
-          out_char(u2h(pwr_steps[pwr_idx] & 0x0f));
-          out_char('\r');
-          out_char('\n');
-          break;
-        case 'S':  //    set
-          if (!got_val) {
+// Parse one received character, called from cdc_rx_poll().
+static void cdc_rx_char(char c) {
+  //    delimiter?
+  out_char(c);
+  if (c > 0x20) {
+    if ('a' <= c && c <= 'z') c -= 0x20;  //    to upper case
+    rbuf[rcnt++] = c;
+    rcnt &= 7;
+    return;
+  }
+  if (rcnt == 0) return;
+
+  //    command
+  if (rcnt == 1) {
+    const char *ptr;
+
+    switch (rbuf[0]) {
+      case '?':  //    who
+        ptr = PSTR(CMD_WHO);
+        out_char('\r');
+        out_char('\n');
+        while ((c = pgm_read_byte(ptr++)) != 0) {
+          out_char(c);
+        }
+        out_char('\r');
+        out_char('\n');
+        break;
+      case 'G':  //    get
+        out_crlf();
+        out_hex8(pwr_steps[pwr_idx]);
+        out_crlf();
+        break;
+      case 'T':  //    task statistics
+        print_task_stats();
+        break;
+      case 'I':  //    idle statistics
+        print_idle_stats();
+        break;
+      case 'C':  //    clock
+        print_clock();
+        break;
+      case 'D':  //    data sample
+        print_sample();
+        break;
+      case 'V':  //    supply voltage
+        print_supply();
+        break;
+      case 'P':  //    PWM phase
+        out_crlf();
+        if (got_val) {
+          pwm_phase = val;
+          got_val = 0;
+        } else {
+          out_hex8(pwm_phase);
+          out_char(' ');
+          out_hex8(heater_pos(timer_counter, 0));
+          out_char(' ');
+          out_hex8(1 << HEATER_PWM_SHIFT);
+          out_crlf();
+        }
+        break;
+      case 'A':  //    arm capture
+        if (got_val) {
+          capture_arm(val);
+          got_val = 0;
+          out_crlf();
+        } else {
+          print_capture();
+        }
+        break;
+      case 'Q':  //    capture rate divider
+        if (got_val) {
+          capture_rate = val;
+          got_val = 0;
+        }
+        out_crlf();
+        break;
+      case 'L':  //    capture trigger level
+        if (got_val) {
+          capture_level = val;
+          got_val = 0;
+        }
+        out_crlf();
+        break;
+      case 'X':  //    dump capture
+        start_dump();
+        break;
+      case 'K':  //    calibration point
+        if (got_val) {
+          got_val = 0;
+          if (!cal_record(val)) {
             print_syntax_error();
-            rcnt = 0;
-            continue;
+            break;
           }
-          cli();
-          pwr_steps[PWR_STEPS_LEN] = val;
-          pwr_idx = PWR_STEPS_LEN;
-          sei();
+          out_crlf();
+        } else {
+          print_cal();
+        }
+        break;
+      case 'E':  //    energy and usage counters
+        if (got_val && val != 0) {
+          print_syntax_error();
+        } else {
+          print_meter();
+          if (got_val && !meter_reset()) print_syntax_error();
+        }
+        got_val = 0;
+        break;
+      case 'J':  //    joint detection
+        if (got_val == 2 && val2 < REHEAT_PARAMS) {
+          reheat_param[val2] = val;
+          out_crlf();
+        } else if (got_val && (got_val == 2 || val != 0)) {
+          print_syntax_error();
+        } else {
+          print_reheat();
+          if (got_val) reheat_reset();
+        }
+        got_val = 0;
+        break;
+      case 'M':  //    RAM usage
+        print_ram();
+        break;
+      case 'W':  //    leased duty cycle
+        if (got_val == 2 && val2 != 0) {
+          lease_duty(val2, val);
+        } else if (got_val) {
+          print_syntax_error();
+        } else {
+          print_lease();
+        }
+        got_val = 0;
+        break;
+      case 'H':  //    flash page checksums
+        print_pages(val, got_val);
+        got_val = 0;
+        break;
+      case 'R':  //    reboot into the bootloader
+        if (!got_val || val != CDC_REBOOT) {
+          print_syntax_error();
           got_val = 0;
-          out_char('\r');
-          out_char('\n');
           break;
-        default:  //    error
+        }
+        usbDeviceDisconnect();
+        wdt_enable(WDTO_15MS);
+        for (;;) {
+        }
+      case 'U':  //    set temperature
+        if (!got_val || !cal_valid()) {
           print_syntax_error();
-      }
-      rcnt = 0;
-      continue;
-    }
-
-    //    number
-    if (rcnt == 2) {
-      if (not_hex_digit(rbuf[0]) || not_hex_digit(rbuf[1])) {
+          got_val = 0;
+          break;
+        }
+        standby_reset();
+        heater_set(cal_duty(val), 0);
+        got_val = 0;
+        out_crlf();
+        break;
+      case 'B':  //    standby timeout
+        out_crlf();
+        if (got_val) {
+          standby_timeout = val;
+          got_val = 0;
+        } else {
+          out_hex8(standby_state());
+          out_char(' ');
+          out_hex8(standby_timeout);
+          out_char(' ');
+          out_hex16(standby_recovery_ms());
+          out_crlf();
+        }
+        break;
+      case 'S':  //    set
+        if (!got_val) {
+          print_syntax_error();
+          rcnt = 0;
+          return;
+        }
+        standby_reset();
+        heater_set(val, 0);
+        got_val = 0;
+        out_char('\r');
+        out_char('\n');
+        break;
+      default:  //    error
         print_syntax_error();
-        rcnt = 0;
-        continue;
-      }
-      val = (h2u(rbuf[0]) << 4) | h2u(rbuf[1]);
-      got_val = 1;
-      rcnt = 0;
-      continue;
     }
+    rcnt = 0;
+    return;
+  }
 
-    if (rcnt > 2) {
+  //    number
+  if (rcnt == 2) {
+    if (not_hex_digit(rbuf[0]) || not_hex_digit(rbuf[1])) {
       print_syntax_error();
       rcnt = 0;
+      return;
     }
+    val2 = val;  // 'W' takes two values
+    val = (h2u(rbuf[0]) << 4) | h2u(rbuf[1]);
+    got_val = got_val ? 2 : 1;
+    rcnt = 0;
+    return;
+  }
+
+  if (rcnt > 2) {
+    print_syntax_error();
+    rcnt = 0;
+  }
+}
+
+// Called from usbPoll() for every OUT packet. Only copies the data into the
+// RX ring, parsing and replies happen in cdc_rx_poll(). Flow control (NAK)
+// is asserted only while the ring can't take another full packet. 'make
+// simtest' measures its run time for a full and an empty packet.
+void usbFunctionWriteOut(uchar *data, uchar len) {
+  rx_packets++;
+  while (len--) {
+    rxbuf[rxw++ & RXBUF_MSK] = *data++;
+  }
+  if ((uint8_t)(rxw - rxr) > RXBUF_SZ - 8) {
+    usbDisableAllRequests();
+    if (rx_stalls != 0xFF) rx_stalls++;
+  }
+}
 
-  } while (--len);
+// Parse the received characters while the transmit buffer can take the
+// longest reply and no multi-part reply is in progress.
+static void cdc_rx_poll(void) {
+  while (rxr != rxw && !dumping && !stats_id && !map_id &&
+         tx_free() >= CDC_REPLY_MAX) {
+    cdc_rx_char(rxbuf[rxr++ & RXBUF_MSK]);
+  }
+  if (usbAllRequestsAreDisabled() && (uint8_t)(rxw - rxr) <= RXBUF_SZ - 8) {
+    usbEnableAllRequests();
+  }
+}
+
+static void cdc_tx_poll(void) {
+  // device -> host
+  if (usbInterruptIsReady()) {
+    if (twcnt != trcnt || sendEmptyFrame) {
+      uchar tlen;
+
+      tlen = twcnt >= trcnt ? (twcnt - trcnt) : (TBUF_SZ - trcnt);
+      if (tlen > 8) tlen = 8;
+      usbSetInterrupt((uchar *)tbuf + trcnt, tlen);
+      trcnt += tlen;
+      trcnt &= TBUF_MSK;
+      // Send an empty block after last data block to indicate transfer end.
+      sendEmptyFrame = (tlen == 8 && twcnt == trcnt) ? 1 : 0;
+    }
+  }
+}
 
+static void cdc_notify_poll(void) {
+  // We need to report rx and tx carrier after open attempt.
+  if (intr3Status != 0 && usbInterruptIsReady3()) {
+    static uchar serialStateNotification[10] = {0xa1, 0x20, 0, 0, 0,
+                                                0,    2,    0, 3, 0};
+
+    if (intr3Status == 2) {
+      usbSetInterrupt3(serialStateNotification, 8);
+    } else {
+      usbSetInterrupt3(serialStateNotification + 8, 2);
+    }
+    intr3Status--;
+  }
+}
+
+void cdc_poll(void) {
+  cdc_rx_poll();
+  cdc_tx_poll();
+  report_interrupt();
+  cdc_notify_poll();
+  dump_poll();
+  stats_poll();
+  map_poll();
+}
+
+uchar usbResetSeen; /* set by USB_RESET_HOOK */
+
+// Drop everything queued for the old connection.
+static void cdc_reset(void) {
+  twcnt = trcnt = 0;
+  rxw = rxr = 0;
+  rcnt = 0;
+  got_val = 0;
+  dumping = 0;
+  stats_id = 0;
+  map_id = 0;
+  intr3Status = 0;
+  sendEmptyFrame = 0;
+  usbResetSeen = 0;
   usbEnableAllRequests();
 }
 
+// Periodic task: re-attach a stuck USB connection in place. Only the USB
+// lines are touched, the PWM and all control tasks keep running; the
+// hardware watchdog is left for a wedged main loop.
+void cdc_watch_task(void) {
+  uint8_t cause = 0, limit = 0;
+
+  if (detach_periods) {
+    if (--detach_periods == 0) {
+      cdc_reset();
+      usbDeviceConnect();
+      report_event('U', reattaches);  // sent once the host reads again
+    }
+    return;
+  }
+
+  if (!usbConfiguration) {
+    if (usbResetSeen && enum_tries < CDC_ENUM_TRIES) {
+      cause = CDC_STUCK_ENUM;
+      limit = CDC_ENUM_MS / CDC_WATCH_PERIOD_MS;
+    }
+  } else {
+    enum_tries = 0;
+    if (twcnt != trcnt && trcnt == watch_tx && rxr != rxw) {
+      cause = CDC_STUCK_IN;
+      limit = CDC_STALL_MS / CDC_WATCH_PERIOD_MS;
+    }
+  }
+  watch_tx = trcnt;
+
+  if (cause != watch_cause) {
+    watch_cause = cause;
+    watch_periods = 0;
+  }
+  if (!cause || ++watch_periods < limit) return;
+
+  watch_cause = 0;
+  watch_periods = 0;
+  if (cause == CDC_STUCK_ENUM) enum_tries++;
+  if (reattaches != 0xFF) reattaches++;
+  reattach_cause = cause;
+  usbDeviceDisconnect();
+  detach_periods = CDC_DETACH_MS / CDC_WATCH_PERIOD_MS;
+}
+
 static uchar intr_flag[4];
 
 #define INTR_REG(x) \
@@ -281,7 +930,6 @@ ISR(INT0_vect) INTR_REG(2);
 ISR(TIMER1_COMPA_vect) INTR_REG(4);
 ISR(EE_RDY_vect) INTR_REG(7);
 ISR(ANA_COMP_vect) INTR_REG(8);
-ISR(ADC_vect) INTR_REG(9);
 ISR(TIMER1_COMPB_vect) INTR_REG(10);
 ISR(TIMER0_COMPA_vect) INTR_REG(11);
 ISR(TIMER0_COMPB_vect) INTR_REG(12);
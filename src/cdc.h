@@ -1,4 +1,5 @@
 #ifndef __CDC_H__
+#define __CDC_H__
 /*
  * Authors: Osamu Tamura, tickelton@gmail.com
  * Licenses: AVR-CDC/CDC-IO: Proprietary, free under certain conditions.
@@ -14,11 +15,47 @@
 #include <string.h>
 #include <util/delay.h>
 
+#include "meter.h"
+#include "model.h"
 #include "usbdrv.h"
 
 #define CMD_WHO "usb_solderin_iron v0.1"
 #define TBUF_SZ 128
 #define TBUF_MSK (TBUF_SZ - 1)
+#define RXBUF_SZ 16 /* holds two OUT packets */
+#define RXBUF_MSK (RXBUF_SZ - 1)
+/* Longest single reply, '00 E': CR LF, the energy and CR LF, 'minutes
+ * heatups' and CR LF per preset, then CR LF '!' CR LF if the reset failed.
+ * Plus the echo of the delimiter. */
+#define CDC_REPLY_MAX (12 + 11 * METER_PRESETS + 5 + 1)
+#define CDC_EVENT_LEN 17 /* '\C####@########' and CR LF */
+#define CDC_DUMP_LINE 16 /* encoded capture bytes per dump line */
+#define CDC_PAGE_LINE 8  /* page checksums per 'H' reply */
+#define CDC_REBOOT 0xB0  /* '## R' value that enters the bootloader */
+
+#if CDC_REPLY_MAX > TBUF_SZ - 1
+#error "the 'E' reply doesn't fit into the transmit buffer"
+#endif
+
+/* USB watchdog: re-attach if the host reset the bus but didn't configure
+ * the device within CDC_ENUM_MS, or if the IN endpoint didn't take any data
+ * for CDC_STALL_MS while the host keeps sending commands. A host without a
+ * driver never configures it, so after CDC_ENUM_TRIES re-attaches in a row
+ * the enumeration is left alone until the device was configured. */
+#define CDC_WATCH_PERIOD_MS 100
+#define CDC_ENUM_MS 5000
+#define CDC_ENUM_TRIES 3
+#define CDC_STALL_MS 2000
+#define CDC_DETACH_MS 300
+#define CDC_STUCK_ENUM 1
+#define CDC_STUCK_IN 2
+
+/* Start of the micronucleus bootloader, passed by the Makefile from the
+ * bootloader configuration. */
+#ifndef BOOTLOADER_ADDRESS
+#define BOOTLOADER_ADDRESS 0x1980
+#endif
+#define APP_PAGES (BOOTLOADER_ADDRESS / SPM_PAGESIZE)
 
 enum {
   SEND_ENCAPSULATED_COMMAND = 0,
@@ -32,17 +69,23 @@ enum {
   SEND_BREAK
 };
 
-#define PWR_STEPS_LEN 4
-uint8_t pwr_steps[PWR_STEPS_LEN + 1];
-uint8_t pwr_idx;
+#define PWR_STEPS_LEN (MODEL_PRESETS + 1)  // off and the presets
+#define PWR_IDX_CUSTOM PWR_STEPS_LEN         // set by the 'S' command
+#define PWR_IDX_STANDBY (PWR_STEPS_LEN + 1)  // standby and recovery boost
+extern uint8_t pwr_steps[PWR_STEPS_LEN + 2];
+extern uint8_t pwr_idx;
+extern uint8_t pwm_phase; /* PWM period start in 1/256, see heater_pos() */
 
-uchar modeBuffer[7];
-uchar sendEmptyFrame;
-uchar intr3Status; /* used to control interrupt endpoint transmissions */
+extern uchar modeBuffer[7];
+extern uchar sendEmptyFrame;
+extern uchar intr3Status; /* used to control interrupt endpoint transmissions */
 
-uchar rcnt, twcnt, trcnt;
-char tbuf[TBUF_SZ];
+extern uchar rcnt, twcnt, trcnt;
+extern char tbuf[TBUF_SZ];
 
 void hardwareInit(void);
 void report_interrupt(void);
+void cdc_poll(void);
+void cdc_watch_task(void);
+void report_event(uchar code, uint16_t val);
 #endif  // __CDC_H__
@@ -0,0 +1,86 @@
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ */
+
+#include "heater.h"
+
+#include <avr/interrupt.h>
+
+#include "capture.h"
+#include "cdc.h"
+#include "reheat.h"
+#include "sensor.h"
+
+volatile uint8_t heater_duty;
+
+static uint16_t vcc_seen;
+static uint16_t factor = 0x0100;
+static uint8_t duty_max = 0xFF;
+static uint8_t setpoint;
+static uint8_t boost;  // from reheat_update()
+static uint8_t lease;
+static uint8_t expiries;
+
+// Only called when the supply voltage changed, i.e. every 100ms at most.
+static void heater_calibrate(uint16_t mv) {
+  uint16_t v = mv / 10;
+  uint32_t f, m;
+
+  f = ((uint32_t)(HEATER_NOMINAL_MV / 10) * (HEATER_NOMINAL_MV / 10) << 8) /
+      ((uint32_t)v * v);
+  factor = f > HEATER_MAX_FACTOR ? HEATER_MAX_FACTOR : f;
+
+  // I = VCC / R * duty / 256
+  m = (uint32_t)HEATER_BUDGET_MA * HEATER_MOHM * 256 / ((uint32_t)mv * 1000);
+  duty_max = m > 0xFF ? 0xFF : m;
+}
+
+static void heater_update(void) {
+  uint16_t mv = sensor_vcc();
+  uint16_t d;
+
+  if (mv != vcc_seen && mv != 0) {
+    vcc_seen = mv;
+    heater_calibrate(mv);
+  }
+
+  if (pwr_steps[pwr_idx] != setpoint) {
+    setpoint = pwr_steps[pwr_idx];
+    capture_trigger(CAPTURE_TRIG_SETPOINT);
+  }
+
+  d = (((uint16_t)setpoint * factor) >> 8) + boost;
+  if (d > duty_max) d = duty_max;
+  heater_duty = d;
+}
+
+void heater_task(void) {
+  if (lease) {
+    if (pwr_idx != PWR_IDX_CUSTOM) {
+      lease = 0;  // another preset was selected
+    } else if (--lease == 0) {
+      pwr_idx = HEATER_LEASE_FALLBACK;
+      if (expiries != 0xFF) expiries++;
+      report_event('E', expiries);
+    }
+  }
+  boost = reheat_update(pwr_steps[pwr_idx], lease != 0);
+  heater_update();
+}
+
+void heater_set(uint8_t duty, uint8_t ticks) {
+  cli();
+  pwr_steps[PWR_IDX_CUSTOM] = duty;
+  pwr_idx = PWR_IDX_CUSTOM;
+  sei();
+  lease = ticks;
+  heater_update();
+}
+
+uint8_t heater_lease(void) { return lease; }
+
+uint8_t heater_expiries(void) { return expiries; }
+
+uint16_t heater_factor(void) { return factor; }
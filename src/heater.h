@@ -0,0 +1,73 @@
+#ifndef __HEATER_H__
+#define __HEATER_H__
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * Supply voltage compensated heater drive.
+ *
+ * The heater runs from VBUS, its power scales with VCC^2. The duty cycle
+ * selected by pwr_steps[pwr_idx] is meant for HEATER_NOMINAL_MV and gets
+ * scaled by (HEATER_NOMINAL_MV / VCC)^2 so the delivered power stays the
+ * same when VBUS sags. While a joint is being soldered, the boost of
+ * reheat.h is added. The result is limited so the average heater current
+ * stays within HEATER_BUDGET_MA.
+ *
+ * A host running its own controller sets the duty cycle with a lease: if it
+ * isn't renewed in time the heater falls back to a preset, so a crashed or
+ * disconnected host can't leave the iron heating at full power.
+ */
+
+#include <stdint.h>
+
+#include "model.h"
+#include "usbconfig.h"
+
+// HEATER_MOHM, HEATER_BUDGET_MA and HEATER_PWM_SHIFT come from the model
+// descriptor in the Makefile.
+#if HEATER_BUDGET_MA > USB_CFG_MAX_BUS_POWER - 20  // minus the MCU
+#error "HEATER_BUDGET_MA exceeds USB_CFG_MAX_BUS_POWER"
+#endif
+#define HEATER_NOMINAL_MV 5000L   // supply voltage the presets are meant for
+#define HEATER_MAX_FACTOR 0x0200  // limit compensation to 2x (8.8 fixed point)
+#define HEATER_PERIOD_MS 10
+#define HEATER_LEASE_FALLBACK 0  // pwr_steps index used when a lease expires
+
+// Effective duty cycle used by TIMER0_OVF_vect.
+extern volatile uint8_t heater_duty;
+
+// Position within the PWM period in 1/256 at TIMER0 overflow 'counter',
+// advancing by 1 << HEATER_PWM_SHIFT per overflow.
+static inline uint8_t heater_pos(uint8_t counter, uint8_t phase) {
+  return (uint8_t)(counter << HEATER_PWM_SHIFT) - phase;
+}
+
+// PWM output state at position 'pos' within the period, given the state
+// 'on' during the previous step. Called from TIMER0_OVF_vect, and by the
+// host simulation (tools/ironsim.c).
+static inline uint8_t heater_pwm(uint8_t pos, uint8_t on) {
+  if (pos < (1 << HEATER_PWM_SHIFT)) on = 1;  // first step of the period
+  if (pos >= heater_duty) on = 0;  // also when lowered during the on-time
+  return on;
+}
+
+// Periodic task: recalculate heater_duty from the active preset.
+void heater_task(void);
+
+// Select 'duty' as the custom preset and apply it right away. With 'ticks'
+// != 0 it is leased for that many HEATER_PERIOD_MS, after which the preset
+// HEATER_LEASE_FALLBACK is selected and '\E' (number of expiries) reported.
+// Selecting another preset ends the lease.
+void heater_set(uint8_t duty, uint8_t ticks);
+
+// Remaining lease in HEATER_PERIOD_MS, 0 if none.
+uint8_t heater_lease(void);
+
+// Number of leases that expired (saturating).
+uint8_t heater_expiries(void);
+
+// Compensation factor applied to the preset (8.8 fixed point).
+uint16_t heater_factor(void);
+
+#endif  // __HEATER_H__
@@ -8,9 +8,19 @@
 
 #include <avr/io.h>
 #include <avr/iotn85.h>
+#include <avr/sleep.h>
 
+#include "cal.h"
+#include "capture.h"
 #include "cdc.h"
+#include "heater.h"
+#include "meter.h"
+#include "nvm.h"
 #include "oddebug.h"
+#include "sched.h"
+#include "sensor.h"
+#include "standby.h"
+#include "timebase.h"
 
 #define LED1 PB4
 #define MOSFET PB1
@@ -23,6 +33,13 @@
 #define PIN_ON(mask) (PORTB &= (uint8_t) ~(1 << mask))
 #define PIN_TOGGLE(mask) (PORTB ^= (uint8_t)(1 << mask))
 
+// Suspend is found by polling as the USB interrupt is on D+. The bus is
+// checked once per TIMER0 overflow (~4ms), so suspend is detected at most
+// ~7.1ms after the last keep-alive, within the 10ms USB allows. With the bus
+// active each check waits ~0.5ms on average for the next keep-alive.
+#define SUSPEND_IDLE_COUNTS 200  // ~3.1ms in TIMER0 counts (256 / F_CPU)
+#define SUSPEND_FRAME_COUNTS 72  // ~1.1ms, one frame with some margin
+
 #define DEBOUNCE_10MS \
   (uint8_t)(int16_t) - (F_CPU / 1024 * 10e-3 + 0.5);  // timer preload for 10ms
 
@@ -30,6 +47,8 @@ volatile uint8_t timer_counter = 0;
 volatile uint8_t key_state;
 volatile uint8_t key_press;
 
+static uint8_t suspend_override;
+
 void ioInit(void) {
   DDRB |= (1 << LED1 | 1 << MOSFET);  // Set LED and FET ports as outputs.
   DDRB &= ~(1 << BUTTON_DD);          // Set button port as input.
@@ -51,16 +70,17 @@ void timersInit(void) {
 }
 
 ISR(TIMER0_OVF_vect) {
-  if (timer_counter == 0) {
-    PIN_ON(LED1);
-    PIN_ON(MOSFET);
-  }
-  if (timer_counter == pwr_steps[pwr_idx]) {
-    PIN_OFF(LED1);
-    PIN_OFF(MOSFET);
+  uint8_t on = !(PORTB & (1 << MOSFET));
+
+  if (heater_pwm(heater_pos(timer_counter, pwm_phase), on) != on) {
+    PIN_TOGGLE(LED1);
+    PIN_TOGGLE(MOSFET);
+    on = !on;
   }
+  if (on) meter_steps++;  // on until the next overflow
 
   ++timer_counter;
+  timebase_tick();
 }
 
 ISR(TIMER1_OVF_vect) {
@@ -68,6 +88,7 @@ ISR(TIMER1_OVF_vect) {
   uint8_t i;
 
   TCNT1 = DEBOUNCE_10MS;
+  ++sched_ticks;
 
   i = key_state ^ ~BUTTON_PIN;  // key changed ?
   ct0 = ~(ct0 & i);             // reset or count ct0
@@ -95,12 +116,99 @@ uint8_t get_key_state(uint8_t key_mask)
   return key_mask;
 }
 
+// Watch D- for bus activity: the low-speed keep-alive (SE0 for ~1.3us,
+// once per 1ms frame) or any packet. D+ is low both in idle and SE0, so the
+// USB pin change interrupt doesn't see keep-alives. Packets are received by
+// the USB interrupt which shows up as a gap of more than 2 TIMER0 counts
+// here, the timer interrupts are much shorter than one count.
+// Returns 1 if the bus was idle for 'counts'.
+static uint8_t usb_bus_idle(uint8_t counts) {
+  uint8_t start, last, now;
+
+  start = last = TCNT0;
+  do {
+    if (!(USBIN & (1 << USBMINUS))) return 0;
+    now = TCNT0;
+    if ((uint8_t)(now - last) > 2) return 0;
+    last = now;
+  } while ((uint8_t)(now - start) < counts);
+  return 1;
+}
+
+// Power down while the host keeps the bus suspended. Only once configured,
+// a USB charger never sends keep-alives. Runs on every pass, the TIMER0
+// overflow wakes the main loop for the next check.
+void suspend_poll(void) {
+  static uint8_t polled;
+  uint8_t adc;
+
+  if (timer_counter == polled) return;
+  polled = timer_counter;
+  if (usbConfiguration == 0 || nvm_busy()) return;
+  // While the button keeps the iron heating, one frame without a keep-alive
+  // is enough to know the bus is still suspended.
+  if (!usb_bus_idle(suspend_override ? SUSPEND_FRAME_COUNTS
+                                     : SUSPEND_IDLE_COUNTS)) {
+    suspend_override = 0;
+    return;
+  }
+  if (suspend_override) return;
+
+  // Heater off, no timer wakeups and no watchdog until the bus resumes.
+  cli();
+  TCCR0B = 0;
+  TCCR1 = 0;
+  PIN_OFF(LED1);
+  PIN_OFF(MOSFET);
+  adc = ADCSRA;
+  ADCSRA = adc & (uint8_t) ~(1 << ADEN);
+  wdt_disable();
+  PCMSK |= (1 << BUTTON_PORT);
+  set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+  sleep_enable();
+  sei();
+  // Resume signalling (K state) raises D+ and the USB interrupt wakes us,
+  // so does the button. Waking takes 16K clocks (~1ms) for the PLL.
+  sleep_cpu();
+  sleep_disable();
+
+  cli();
+  PCMSK &= (uint8_t) ~(1 << BUTTON_PORT);
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  wdt_enable(WDTO_1S);
+  if (adc & (1 << ADEN)) ADCSRA = adc | (1 << ADSC);
+  timersInit();
+  if (heater_pwm(heater_pos(timer_counter, pwm_phase), 1)) {  // mid on-time
+    PIN_ON(LED1);
+    PIN_ON(MOSFET);
+  }
+  sei();
+
+  // Woken by the button: the user wants to solder, keep heating until the
+  // bus was active again.
+  if (!(BUTTON_PIN & (1 << BUTTON_PIN_NUM))) suspend_override = 1;
+
+  // The host may have dropped the serial state while it was asleep.
+  if (intr3Status == 0) intr3Status = 2;
+}
+
+void button_poll(void) {
+  if (get_key_press(1 << BUTTON_PIN_NUM)) {
+    capture_trigger(CAPTURE_TRIG_BUTTON);
+    if (standby_activity()) return;
+    cli();
+    if (++pwr_idx >= PWR_STEPS_LEN) {
+      pwr_idx = 0;
+    }
+    sei();
+  }
+}
+
 int main(void) {
-  pwr_steps[0] = 0;
-  pwr_steps[1] = 200;
-  pwr_steps[2] = 224;
-  pwr_steps[3] = 255;
   pwr_idx = 0;
+  pwm_phase = 0;
+  calInit();
+  meterInit();
 
   wdt_enable(WDTO_1S);
   odDebugInit();
@@ -108,6 +216,7 @@ int main(void) {
   usbInit();
   ioInit();
   timersInit();
+  sensorInit();
 
   intr3Status = 0;
   sendEmptyFrame = 0;
@@ -116,48 +225,33 @@ int main(void) {
   twcnt = 0;
   trcnt = 0;
 
+  sched_add(usbPoll, SCHED_PRIO_USB, SCHED_EVERY_PASS, 0);
+  sched_add(cdc_poll, 1, SCHED_EVERY_PASS, 0);
+  sched_add(button_poll, 3, SCHED_MS(10), SCHED_MS(50));
+  sched_add(sensor_task, 3, SCHED_MS(SENSOR_PERIOD_MS), SCHED_MS(10));
+  sched_add(standby_task, 4, SCHED_MS(STANDBY_PERIOD_MS), SCHED_MS(50));
+  sched_add(heater_task, 3, SCHED_MS(HEATER_PERIOD_MS), SCHED_MS(10));
+  sched_add(nvm_task, 5, SCHED_MS(NVM_PERIOD_MS), SCHED_MS(100));
+  sched_add(sched_idle_update, 4, SCHED_MS(1000), SCHED_MS(100));
+  sched_add(suspend_poll, 4, SCHED_EVERY_PASS, 0);
+  sched_add(meter_task, 4, SCHED_MS(METER_PERIOD_MS), SCHED_MS(50));
+  sched_add(cdc_watch_task, 4, SCHED_MS(CDC_WATCH_PERIOD_MS), SCHED_MS(50));
+
+  set_sleep_mode(SLEEP_MODE_IDLE);
+
   sei();
   for (;;) {
     wdt_reset();
-    usbPoll();
-
-    // device -> host
-    if (usbInterruptIsReady()) {
-      if (twcnt != trcnt || sendEmptyFrame) {
-        uchar tlen;
-
-        tlen = twcnt >= trcnt ? (twcnt - trcnt) : (TBUF_SZ - trcnt);
-        if (tlen > 8) tlen = 8;
-        usbSetInterrupt((uchar *)tbuf + trcnt, tlen);
-        trcnt += tlen;
-        trcnt &= TBUF_MSK;
-        // Send an empty block after last data block to indicate transfer end.
-        sendEmptyFrame = (tlen == 8 && twcnt == trcnt) ? 1 : 0;
-      }
-    }
-
-    report_interrupt();
-
-    // We need to report rx and tx carrier after open attempt.
-    if (intr3Status != 0 && usbInterruptIsReady3()) {
-      static uchar serialStateNotification[10] = {0xa1, 0x20, 0, 0, 0,
-                                                  0,    2,    0, 3, 0};
-
-      if (intr3Status == 2) {
-        usbSetInterrupt3(serialStateNotification, 8);
-      } else {
-        usbSetInterrupt3(serialStateNotification + 8, 2);
-      }
-      intr3Status--;
-    }
+    if (sched_run()) continue;
 
-    if (get_key_press(1 << BUTTON_PIN_NUM)) {
-      cli();
-      if (++pwr_idx >= PWR_STEPS_LEN) {
-        pwr_idx = 0;
-      }
-      sei();
+    // Everything else is interrupt driven: the USB pin change interrupt,
+    // TIMER0 (~4ms) and TIMER1 (10ms) wake us up again. Don't sleep while
+    // V-USB holds a received message that usbPoll() hasn't processed yet.
+    cli();
+    if (usbRxLen == 0) {
+      sched_sleep();
     }
+    sei();
   }
   return 0;
 }
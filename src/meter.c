@@ -0,0 +1,103 @@
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ */
+
+#include "meter.h"
+
+#include <avr/eeprom.h>
+#include <avr/interrupt.h>
+#include <string.h>
+
+#include "cdc.h"
+#include "heater.h"
+#include "nvm.h"
+#include "sensor.h"
+
+#if METER_PRESETS != PWR_STEPS_LEN + 2
+#error "METER_PRESETS doesn't match pwr_steps"
+#endif
+
+volatile uint8_t meter_steps;
+
+static meter_t m;
+static meter_t EEMEM meter_ee;
+static uint32_t uj;       // energy not yet added to m.energy
+static uint32_t step_uj;  // energy of one TIMER0 overflow with the MOSFET on
+static uint16_t vcc_seen;
+static uint8_t sec[METER_PRESETS];  // run time not yet added to m.minutes
+static uint8_t periods;             // in the current second
+static uint8_t since;               // minutes since the last checkpoint
+static uint8_t cold;
+static uint8_t saving;
+
+static void meter_save(void) {
+  if (nvm_write(&meter_ee, &m, sizeof(m))) {
+    saving = 1;
+    since = 0;
+  }
+}
+
+void meterInit(void) {
+  eeprom_read_block(&m, &meter_ee, sizeof(m));
+  if (m.energy == 0xFFFFFFFF) memset(&m, 0, sizeof(m));  // erased EEPROM
+}
+
+void meter_task(void) {
+  uint16_t mv = sensor_vcc();
+  int16_t t = sensor_temp();
+  uint8_t idx = pwr_idx, steps;
+
+  cli();
+  steps = meter_steps;
+  meter_steps = 0;
+  sei();
+
+  if (mv != vcc_seen) {
+    vcc_seen = mv;
+    // P = VCC^2 / R in mW, one overflow lasts 65536 / F_CPU.
+    step_uj = (uint32_t)mv * mv / HEATER_MOHM * 65536 / (F_CPU / 1000);
+  }
+  uj += steps * step_uj;
+
+  if (++periods == 1000 / METER_PERIOD_MS) {
+    periods = 0;
+    sec[idx]++;
+  }
+  if (t < METER_COLD) cold = 1;
+
+  if (saving) {
+    if (nvm_busy()) return;
+    saving = 0;
+  }
+
+  while (uj >= 1000000) {
+    uj -= 1000000;
+    m.energy++;
+  }
+  if (cold && t > METER_HOT) {
+    cold = 0;
+    m.heatups[idx]++;
+  }
+  if (sec[idx] >= 60) {
+    sec[idx] -= 60;
+    m.minutes[idx]++;
+    if (++since >= METER_CHECKPOINT_MIN) meter_save();
+  }
+}
+
+const meter_t *meter_get(void) { return &m; }
+
+uint8_t meter_reset(void) {
+  // Not while a checkpoint still reads the totals. nvm_task() runs only
+  // after they were cleared, so the job queued here saves the zeros.
+  if (saving) return 0;
+  meter_save();
+  if (!saving) return 0;
+
+  memset(&m, 0, sizeof(m));
+  memset(sec, 0, sizeof(sec));
+  uj = 0;
+  return 1;
+}
@@ -0,0 +1,58 @@
+#ifndef __METER_H__
+#define __METER_H__
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * Energy and usage metering.
+ *
+ * TIMER0_OVF_vect counts the overflows during which the MOSFET is on, so
+ * the energy follows the PWM output as it is driven and not the preset.
+ * Every METER_PERIOD_MS the counted on-time is weighted with the heater
+ * power VCC^2 / HEATER_MOHM from the measured supply voltage.
+ *
+ * For every preset (index into pwr_steps) the run time in minutes and the
+ * number of heat-ups are kept: a heat-up is counted for the active preset
+ * when the tip temperature rises above METER_HOT after it had been below
+ * METER_COLD, i.e. once per thermal cycle that wears the tip.
+ *
+ * The totals are checkpointed to EEPROM every METER_CHECKPOINT_MIN through
+ * nvm_write() and restored at startup. While a checkpoint is written, the
+ * saved totals are left alone and new energy and run time is held back, so
+ * the EEPROM copy is never torn.
+ */
+
+#include <stdint.h>
+
+#include "model.h"
+
+#define METER_PERIOD_MS 100
+#define METER_PRESETS (MODEL_PRESETS + 3)  // PWR_STEPS_LEN, custom, standby
+#define METER_COLD 1000  // 0.1 degrees C
+#define METER_HOT 2000
+#define METER_CHECKPOINT_MIN 10  // ~100k EEPROM cycles last 2 years of use
+
+typedef struct {
+  uint32_t energy;                  // J
+  uint16_t minutes[METER_PRESETS];  // run time per preset
+  uint16_t heatups[METER_PRESETS];
+} meter_t;
+
+// Overflows of TIMER0 with the MOSFET on, counted by TIMER0_OVF_vect.
+extern volatile uint8_t meter_steps;
+
+// Load the totals from EEPROM.
+void meterInit(void);
+
+// Periodic task, runs every METER_PERIOD_MS.
+void meter_task(void);
+
+// Current totals, valid until the next call of meter_task().
+const meter_t *meter_get(void);
+
+// Clear the totals and checkpoint them right away. Returns 0 and leaves
+// them alone while a checkpoint is written or if it can't be queued.
+uint8_t meter_reset(void);
+
+#endif  // __METER_H__
@@ -0,0 +1,73 @@
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ */
+
+#include "nvm.h"
+
+#include <avr/eeprom.h>
+#include <avr/interrupt.h>
+
+typedef struct {
+  uint8_t *dst;  // start of the block, identifies the job
+  const uint8_t *src;
+  uint8_t len;  // 0 when the slot is free
+  uint8_t pos;  // next byte to write
+} nvm_job_t;
+
+static nvm_job_t jobs[NVM_JOBS];
+
+uint8_t nvm_write(void *dst, const void *src, uint8_t len) {
+  nvm_job_t *job = 0;
+  uint8_t i;
+
+  for (i = 0; i < NVM_JOBS; i++) {
+    if (jobs[i].len && jobs[i].dst == dst) {
+      job = &jobs[i];  // restart the pending job
+      break;
+    }
+    if (!jobs[i].len && !job) job = &jobs[i];
+  }
+  if (!job) return 0;
+
+  job->dst = dst;
+  job->src = src;
+  job->len = len;
+  job->pos = 0;
+  return 1;
+}
+
+uint8_t nvm_busy(void) {
+  uint8_t i;
+
+  for (i = 0; i < NVM_JOBS; i++) {
+    if (jobs[i].len) return 1;
+  }
+  return 0;
+}
+
+void nvm_task(void) {
+  nvm_job_t *j;
+  uint8_t i;
+
+  if (!eeprom_is_ready()) return;
+
+  for (i = 0; i < NVM_JOBS; i++) {
+    j = &jobs[i];
+    while (j->len) {
+      uint8_t v = j->src[j->pos];
+      uint8_t *dst = j->dst + j->pos;
+
+      if (++j->pos == j->len) j->len = 0;
+      if (eeprom_read_byte(dst) != v) {
+        // Returns right away as the EEPROM is ready. EEMPE/EEPE must be
+        // set within four cycles, keep interrupts out.
+        cli();
+        eeprom_write_byte(dst, v);
+        sei();
+        return;
+      }
+    }
+  }
+}
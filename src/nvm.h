@@ -0,0 +1,33 @@
+#ifndef __NVM_H__
+#define __NVM_H__
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * Background EEPROM writer.
+ *
+ * Writing an EEPROM byte takes ~3.4ms, during which eeprom_*() calls busy
+ * wait. nvm_task() instead writes one byte per call and only when the
+ * EEPROM is ready, so blocks of data can be saved without stalling
+ * usbPoll(). Bytes that already hold the right value aren't rewritten.
+ */
+
+#include <stdint.h>
+
+#define NVM_JOBS 2
+#define NVM_PERIOD_MS 10
+
+// Queue copying 'len' bytes from RAM at 'src' to EEPROM at 'dst'. The
+// source is read while the job progresses, so it has to stay valid.
+// A pending job for the same destination is restarted instead.
+// Returns 0 if the queue is full.
+uint8_t nvm_write(void *dst, const void *src, uint8_t len);
+
+// Returns 1 while jobs are pending.
+uint8_t nvm_busy(void);
+
+// Periodic task, writes at most one byte per call.
+void nvm_task(void);
+
+#endif  // __NVM_H__
@@ -0,0 +1,49 @@
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ */
+
+#include "ram.h"
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include "ram_map.h"
+
+// Defined by the linker script.
+extern uint8_t __data_start, __data_end, __bss_start, __bss_end, __heap_start;
+
+// Runs from .init3: the stack pointer is set up but nothing is on the stack
+// yet, and as a naked function it must not use any.
+void ram_paint(void) __attribute__((naked, used, section(".init3")));
+
+void ram_paint(void) {
+  uint8_t *p = &__heap_start;
+
+  while (p <= (uint8_t *)RAMEND) *p++ = RAM_CANARY;
+}
+
+void ram_usage(uint16_t *data, uint16_t *bss, uint16_t *free_now,
+               uint16_t *lowest) {
+  const uint8_t *p = &__heap_start;
+
+  while (p <= (uint8_t *)RAMEND && *p == RAM_CANARY) p++;
+  *lowest = p - &__heap_start;
+  *free_now = SP + 1 - (uint16_t)&__heap_start;
+  *data = &__data_end - &__data_start;
+  *bss = &__bss_end - &__bss_start;
+}
+
+const char *ram_module(uint8_t i, uint8_t *data, uint8_t *bss) {
+  const char *name = ram_names;
+
+  if (i >= RAM_MODULES) return 0;
+  *data = pgm_read_byte(&ram_sizes[i][0]);
+  *bss = pgm_read_byte(&ram_sizes[i][1]);
+  while (i--) {
+    while (pgm_read_byte(name++)) {
+    }
+  }
+  return name;
+}
@@ -0,0 +1,34 @@
+#ifndef __RAM_H__
+#define __RAM_H__
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * SRAM usage.
+ *
+ * Before .data and .bss are initialized, everything between the end of the
+ * static variables and the top of the stack is painted with RAM_CANARY.
+ * The stack, including nested interrupts, overwrites the pattern as it
+ * grows, so the number of bytes still holding it is the lowest free stack
+ * since reset. A stack byte that happens to equal RAM_CANARY makes the
+ * figure up to that many bytes too optimistic.
+ *
+ * The static usage per module is taken from the object files at build time
+ * by tools/rammap.awk, which also checks the worst-case stack depth against
+ * the budget.
+ */
+
+#include <stdint.h>
+
+#define RAM_CANARY 0xC5
+
+// Sizes in bytes of the initialized and zeroed static variables, the free
+// stack right now, and the lowest free stack seen since reset.
+void ram_usage(uint16_t *data, uint16_t *bss, uint16_t *free_now,
+               uint16_t *lowest);
+
+// Name (in flash) and static usage of module 'i', 0 past the last one.
+const char *ram_module(uint8_t i, uint8_t *data, uint8_t *bss);
+
+#endif  // __RAM_H__
@@ -0,0 +1,157 @@
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ */
+
+#include "reheat.h"
+
+#include "cdc.h"
+#include "sched.h"
+#include "sensor.h"
+#include "standby.h"
+
+#define BIN_SHIFT (8 - REHEAT_BINS_LOG2)
+
+// REHEAT_PWM_MS must be the PWM period of 256 TIMER0 overflows of 65536
+// cycles >> HEATER_PWM_SHIFT, in whole ms.
+#define MS_CYCLES(ms) ((uint64_t)(ms) * (F_CPU / 1000) << HEATER_PWM_SHIFT)
+_Static_assert(MS_CYCLES(REHEAT_PWM_MS) <= 256ULL * 65536 &&
+                   MS_CYCLES(REHEAT_PWM_MS + 1) > 256ULL * 65536,
+               "REHEAT_PWM_MS is not the PWM period");
+_Static_assert(REHEAT_BIN_MS >= HEATER_PERIOD_MS,
+               "heater_task() must run in every bin");
+
+uint8_t reheat_param[REHEAT_PARAMS] = REHEAT_DEFAULTS;
+
+static reheat_t stats;
+static int16_t ref[REHEAT_BINS];  // average per bin << REHEAT_REF_AVG
+static uint8_t valid;             // bit per bin: ref holds a sample
+static uint8_t steady;            // bit per bin: close to ref last period
+static uint8_t recovered;         // bit per bin: back within the band
+static uint8_t last_bin;
+static int16_t top;      // highest difference to ref since the last low
+static uint8_t falling;  // bins in a row below top (saturating)
+static uint8_t last_idx, last_duty;
+static uint16_t duty_avg;     // requested duty cycle << REHEAT_DUTY_AVG
+static uint16_t boost;        // 8.8 fixed point
+static uint16_t joint_ticks;  // 0 without a joint
+static int16_t droop;
+
+static void reheat_restart(uint8_t duty) {
+  last_idx = pwr_idx;
+  last_duty = duty;
+  duty_avg = (uint16_t)duty << REHEAT_DUTY_AVG;
+  valid = 0;
+  steady = 0;
+  last_bin = 0xFF;
+  falling = 0;
+  top = 0;
+  boost = 0;
+  joint_ticks = 0;
+}
+
+static void joint_start(int16_t d) {
+  // The reading started to fall 'falling' bins ago. REHEAT_LAG_MS is the
+  // time from the contact until the fall clears the noise at the sensor.
+  stats.latency_ms = falling * REHEAT_BIN_MS + REHEAT_LAG_MS;
+  stats.joints++;
+  droop = -d;
+  top = d;
+  recovered = 0;
+  joint_ticks = 1;
+  boost = (uint16_t)reheat_param[REHEAT_P_BOOST] << 8;
+}
+
+static void joint_done(void) {
+  joint_ticks = 0;
+  steady = 0;
+  stats.droop = droop;
+  if (droop > stats.droop_max) stats.droop_max = droop;
+  report_event('J', droop);
+}
+
+uint8_t reheat_update(uint8_t duty, uint8_t leased) {
+  int16_t t = sensor_temp(), d;
+  uint8_t slope = reheat_param[REHEAT_P_SLOPE],
+          step = reheat_param[REHEAT_P_DUTY], bin, mask;
+
+  // A new preset or duty cycle moves the temperature on purpose.
+  if (pwr_idx != last_idx || (!leased && duty != last_duty) || duty == 0 ||
+      standby_state()) {
+    reheat_restart(duty);
+    return 0;
+  }
+
+  if (boost) {
+    uint16_t dec = boost >> (reheat_param[REHEAT_P_DECAY] & 15);
+
+    boost -= dec ? dec : 1;
+  }
+  if (joint_ticks && ++joint_ticks >= REHEAT_JOINT_MS / HEATER_PERIOD_MS) {
+    joint_done();
+  }
+
+  // Compare only at the first tick in every bin of the PWM period, always
+  // at the same point of the ripple.
+  bin = heater_pos(timer_counter, pwm_phase) >> BIN_SHIFT;
+  if (bin == last_bin) return boost >> 8;
+  last_bin = bin;
+  mask = 1 << bin;
+
+  d = t - (ref[bin] >> REHEAT_REF_AVG);
+  if (!(valid & mask)) {
+    valid |= mask;
+    ref[bin] = t << REHEAT_REF_AVG;
+  } else {
+    // With the ripple taken out by the reference, the reading falls once
+    // it is more than the noise below the highest point since the last low.
+    if (d > top) top = d;
+    if (d + REHEAT_BAND / 2 < top) {
+      if (falling != 0xFF) falling++;
+    } else {
+      falling = 0;
+    }
+    if (joint_ticks) {
+      // The reference stays at the level before the contact, the joint is
+      // done once a whole period is back within the band. Another contact
+      // before that shows as a fall by 'slope' after a rise by twice that.
+      if (-d > droop) {
+        droop = -d;
+        top = d;
+      } else if (slope && top - d >= slope && top + droop >= 2 * slope) {
+        joint_done();
+        joint_start(d);
+      }
+      if (d + REHEAT_BAND >= 0) {
+        recovered |= mask;
+      } else {
+        recovered = 0;
+      }
+      if (recovered == 0xFF) joint_done();
+    } else if ((steady & mask) &&
+               ((slope && -d >= slope) ||
+                (step && duty >= (duty_avg >> REHEAT_DUTY_AVG) + step))) {
+      joint_start(d);
+    } else {
+      if (d > -REHEAT_BAND && d < REHEAT_BAND) {
+        steady |= mask;
+      } else {
+        steady &= ~mask;
+      }
+      ref[bin] += d;  // IIR, d is (t - ref) >> REHEAT_REF_AVG
+      top = 0;
+    }
+  }
+  duty_avg += duty - (duty_avg >> REHEAT_DUTY_AVG);
+  return boost >> 8;
+}
+
+const reheat_t *reheat_get(void) { return &stats; }
+
+void reheat_reset(void) {
+  stats.joints = 0;
+  stats.latency_ms = 0;
+  stats.droop = 0;
+  stats.droop_max = 0;
+}
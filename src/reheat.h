@@ -0,0 +1,76 @@
+#ifndef __REHEAT_H__
+#define __REHEAT_H__
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * Joint contact detection and reheat boost.
+ *
+ * When the tip touches a joint, the heater core and with it the sensor
+ * cools down with a lag. Instead of waiting for the temperature to sag (the
+ * presets are open-loop) or for the host's control error to build up, a
+ * contact is detected from
+ *  - the temperature falling REHEAT_P_SLOPE below a reference, or
+ *  - the duty cycle the host asks for with a lease rising REHEAT_P_DUTY
+ *    above its recent average,
+ * once the temperature had settled. The PWM period is split into
+ * REHEAT_BINS bins with a reference each, averaged over the last periods at
+ * the same point of the ripple, so a fall shows within one bin instead of a
+ * whole period. That is still ~1s after the contact with the sensor lag of
+ * the stock iron. The duty cycle is then raised by REHEAT_P_BOOST, decaying
+ * with a time constant of 2^REHEAT_P_DECAY * HEATER_PERIOD_MS. The current
+ * budget still applies on top, the presets stay below it to leave room.
+ *
+ * A joint lasts until a whole period is back within REHEAT_BAND of the level
+ * before the contact, or REHEAT_JOINT_MS. Then its droop is reported as
+ * '\J<0.1 degrees C>'. If the temperature falls again before that, the next
+ * joint starts without waiting for the reading to settle. The latency is an
+ * estimate of the time from the contact until the detection: the bins since
+ * the fall cleared the noise plus REHEAT_LAG_MS.
+ */
+
+#include <stdint.h>
+
+#include "heater.h"
+
+#define REHEAT_BINS_LOG2 3  // the PWM period is split into 8 bins
+#define REHEAT_BINS (1 << REHEAT_BINS_LOG2)
+#define REHEAT_PWM_MS ((256UL * 65536 / (F_CPU / 1000)) >> HEATER_PWM_SHIFT)
+#define REHEAT_BIN_MS (REHEAT_PWM_MS / REHEAT_BINS)
+#define REHEAT_LAG_MS 850   // contact to a fall of REHEAT_BAND / 2
+#define REHEAT_REF_AVG 2    // reference averaged over 2^n periods
+#define REHEAT_DUTY_AVG 8   // requested duty averaged over 2^n periods
+#define REHEAT_BAND 20      // 0.1 degrees C
+#define REHEAT_JOINT_MS 30000
+
+// Tunable parameters, index into reheat_param[].
+enum {
+  REHEAT_P_SLOPE,  // fall below the reference in 0.1 degrees C
+  REHEAT_P_DUTY,   // rise of the requested duty cycle
+  REHEAT_P_BOOST,  // extra duty cycle, 0 only detects and reports
+  REHEAT_P_DECAY,  // time constant 2^n * HEATER_PERIOD_MS
+  REHEAT_PARAMS
+};
+#define REHEAT_DEFAULTS {15, 0, 0x80, 8}
+
+extern uint8_t reheat_param[REHEAT_PARAMS];
+
+typedef struct {
+  uint16_t joints;      // detected
+  uint16_t latency_ms;  // of the last joint
+  uint16_t droop;       // of the last joint, 0.1 degrees C
+  uint16_t droop_max;
+} reheat_t;
+
+// Called from heater_task() every HEATER_PERIOD_MS with the duty cycle of
+// the active preset and whether it is leased by the host. Returns the
+// boost to add to it.
+uint8_t reheat_update(uint8_t duty, uint8_t leased);
+
+const reheat_t *reheat_get(void);
+
+// Clear the statistics.
+void reheat_reset(void);
+
+#endif  // __REHEAT_H__
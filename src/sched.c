@@ -0,0 +1,180 @@
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ */
+
+#include "sched.h"
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/sleep.h>
+
+#define SCHED_ONESHOT 0x80  // flag in 'period'
+
+typedef struct {
+  sched_fn_t fn;
+  uint8_t period;  // ticks, SCHED_EVERY_PASS or SCHED_ONESHOT
+  uint8_t next;    // tick of next release
+  uint8_t deadline;
+  uint8_t prio;
+  uint8_t misses;
+  uint16_t max_run;
+} sched_task_t;
+
+volatile uint8_t sched_ticks;
+
+static sched_task_t tasks[SCHED_MAX_TASKS];
+static uint8_t order[SCHED_MAX_TASKS];  // task ids sorted by priority
+static uint8_t n_tasks;
+static uint8_t n_periodic;
+
+static uint16_t sleep_count, sleep_time;  // current second
+static uint16_t idle_wakeups;             // last second
+static uint8_t idle_ratio;
+
+// Read TIMER0 as a 16 bit value (timer_counter:TCNT0).
+static uint16_t sched_clock(void) {
+  uint8_t hi, lo;
+
+  cli();
+  hi = timer_counter;
+  lo = TCNT0;
+  if ((TIFR & (1 << TOV0)) && lo < 0x80) {  // overflow not yet serviced
+    ++hi;
+  }
+  sei();
+  return (uint16_t)hi << 8 | lo;
+}
+
+static uint8_t sched_insert(sched_fn_t fn, uint8_t prio, uint8_t period,
+                            uint8_t next, uint8_t deadline) {
+  uint8_t id, i;
+
+  for (id = 0; id < SCHED_MAX_TASKS; id++) {
+    if (tasks[id].fn == 0) break;
+  }
+  if (id == SCHED_MAX_TASKS) return SCHED_NONE;
+
+  tasks[id].fn = fn;
+  tasks[id].period = period;
+  tasks[id].next = next;
+  tasks[id].deadline = deadline;
+  tasks[id].prio = prio;
+  tasks[id].misses = 0;
+  tasks[id].max_run = 0;
+
+  // Tasks of equal priority run in the order they were added.
+  for (i = n_tasks; i > 0 && tasks[order[i - 1]].prio > prio; i--) {
+    order[i] = order[i - 1];
+  }
+  order[i] = id;
+  n_tasks++;
+
+  return id;
+}
+
+static void sched_remove(uint8_t pos) {
+  tasks[order[pos]].fn = 0;
+  for (--n_tasks; pos < n_tasks; pos++) {
+    order[pos] = order[pos + 1];
+  }
+}
+
+uint8_t sched_add(sched_fn_t fn, uint8_t prio, uint8_t period,
+                  uint8_t deadline) {
+  uint8_t id = SCHED_NONE;
+
+  if (n_periodic < SCHED_PERIODIC_TASKS) {
+    id = sched_insert(fn, prio, period, sched_ticks + period, deadline);
+  }
+  if (id == SCHED_NONE) {
+    cli();
+    for (;;) {
+    }
+  }
+  n_periodic++;
+  return id;
+}
+
+uint8_t sched_once(sched_fn_t fn, uint8_t prio, uint8_t delay,
+                   uint8_t deadline) {
+  return sched_insert(fn, prio, SCHED_ONESHOT, sched_ticks + delay, deadline);
+}
+
+uint8_t sched_run(void) {
+  uint8_t pos, now, late;
+  uint16_t start, run;
+  sched_task_t *t;
+
+  for (pos = 0; pos < n_tasks; pos++) {
+    t = &tasks[order[pos]];
+    now = sched_ticks;
+
+    if (t->period != SCHED_EVERY_PASS) {
+      late = now - t->next;
+      if (late & 0x80) continue;  // not yet due
+      if (late > t->deadline && t->misses != 0xFF) t->misses++;
+    }
+
+    start = sched_clock();
+    t->fn();
+    run = sched_clock() - start;
+    if (run > t->max_run) t->max_run = run;
+
+    if (t->period == SCHED_EVERY_PASS) continue;
+
+    if (t->period == SCHED_ONESHOT) {
+      sched_remove(pos);
+    } else {
+      t->next += t->period;
+      if ((uint8_t)(now - t->next) < 0x80) {
+        t->next = now + t->period;  // fell behind, don't try to catch up
+      }
+    }
+    return 1;  // restart from the highest priority task
+  }
+  return 0;
+}
+
+void sched_sleep(void) {
+  uint8_t start;
+
+  start = TCNT0;
+  sleep_enable();
+  sei();
+  sleep_cpu();  // executed before any pending interrupt
+  sleep_disable();
+
+  // TIMER0 wakes us at least once per overflow, so it can't wrap twice.
+  sleep_time += (uint8_t)(TCNT0 - start);
+  sleep_count++;
+}
+
+void sched_idle_update(void) {
+  uint16_t t;
+
+  t = sleep_time;
+  idle_wakeups = sleep_count;
+  sleep_time = 0;
+  sleep_count = 0;
+
+  // One second is F_CPU / 256 ~= 0xFBC5 TIMER0 counts.
+  idle_ratio = t >> 8;
+}
+
+void sched_idle_stats(uint16_t *wakeups, uint8_t *ratio, uint16_t *current) {
+  *wakeups = idle_wakeups;
+  *ratio = idle_ratio;
+  *current = SCHED_ACTIVE_UA -
+             (uint16_t)(((uint32_t)(SCHED_ACTIVE_UA - SCHED_IDLE_UA) *
+                         idle_ratio) >> 8);
+}
+
+uint8_t sched_stats(uint8_t id, uint16_t *max_run, uint8_t *misses) {
+  if (id >= SCHED_MAX_TASKS || tasks[id].fn == 0) return 0;
+
+  *max_run = tasks[id].max_run;
+  *misses = tasks[id].misses;
+  return 1;
+}
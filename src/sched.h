@@ -0,0 +1,82 @@
+#ifndef __SCHED_H__
+#define __SCHED_H__
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * Cooperative deadline scheduler for the main loop.
+ *
+ * All timing is derived from a single hardware tick (SCHED_TICK_MS) that is
+ * advanced by TIMER1_OVF_vect. Tasks are kept ordered by priority (lower
+ * value = higher priority). Tasks added with period SCHED_EVERY_PASS run on
+ * every pass of sched_run(), all other tasks run when they are due. At most
+ * one due periodic or one-shot task runs per pass so that the high priority
+ * every-pass tasks (i.e. usbPoll()) are serviced between any two of them.
+ */
+
+#include <stdint.h>
+
+#define SCHED_PERIODIC_TASKS 11  // slots for sched_add()
+#define SCHED_ONESHOT_TASKS 2    // kept free for sched_once()
+#define SCHED_MAX_TASKS (SCHED_PERIODIC_TASKS + SCHED_ONESHOT_TASKS)
+#define SCHED_TICK_MS 10  // period of TIMER1_OVF_vect
+
+#define SCHED_EVERY_PASS 0  // period: run on every pass of the main loop
+#define SCHED_NONE 0xFF     // returned by sched_once() if the table is full
+
+#define SCHED_PRIO_USB 0  // reserved for usbPoll()
+
+// Convert milliseconds into scheduler ticks (at least one tick).
+#define SCHED_MS(ms) \
+  ((uint8_t)((ms) < SCHED_TICK_MS ? 1 : ((ms) + SCHED_TICK_MS / 2) / SCHED_TICK_MS))
+
+typedef void (*sched_fn_t)(void);
+
+// Scheduler tick counter, advanced by TIMER1_OVF_vect.
+// Periods and deadlines must stay below 128 ticks.
+extern volatile uint8_t sched_ticks;
+
+// PWM step counter, advanced by TIMER0_OVF_vect.
+// Used together with TCNT0 as the run time clock.
+extern volatile uint8_t timer_counter;
+
+// Add a periodic task. 'deadline' is the number of ticks a release may be
+// delayed before it is counted as a miss. Returns the task id. Once
+// SCHED_PERIODIC_TASKS are in use it doesn't return: interrupts stay off
+// until the watchdog resets, so the iron never enumerates instead of
+// silently running without the task.
+uint8_t sched_add(sched_fn_t fn, uint8_t prio, uint8_t period,
+                  uint8_t deadline);
+
+// Add a task that runs once, 'delay' ticks from now. Returns the task id or
+// SCHED_NONE if the table is full.
+uint8_t sched_once(sched_fn_t fn, uint8_t prio, uint8_t delay,
+                   uint8_t deadline);
+
+// Run one pass over the task table.
+// Returns 0 if no periodic or one-shot task was due.
+uint8_t sched_run(void);
+
+// Sleep until the next interrupt. Must be called with interrupts disabled,
+// returns with interrupts enabled.
+void sched_sleep(void);
+
+// Latch the idle statistics, to be called once per second.
+void sched_idle_update(void);
+
+// Estimated supply current of the MCU in uA, taken from the datasheet
+// figures for 16.5 MHz at 5 V since it can't be measured in-circuit.
+#define SCHED_ACTIVE_UA 9000
+#define SCHED_IDLE_UA 3000
+
+// Idle statistics of the last second: number of wakeups from sleep, time
+// spent sleeping in 1/256 and the resulting estimated supply current in uA.
+void sched_idle_stats(uint16_t *wakeups, uint8_t *ratio, uint16_t *current);
+
+// Per-task statistics. 'max_run' is the longest observed run time in
+// TIMER0 counts (256 / F_CPU each), 'misses' the number of deadline misses.
+// Returns 0 if 'id' does not refer to an active task.
+uint8_t sched_stats(uint8_t id, uint16_t *max_run, uint8_t *misses);
+
+#endif  // __SCHED_H__
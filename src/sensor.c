@@ -0,0 +1,116 @@
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ */
+
+#include "sensor.h"
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include "capture.h"
+#include "sensor_table.h"
+#include "timebase.h"
+
+#if SENSOR_TABLE_SHIFT != 5
+#error "sensor_lookup() interpolates 5 bit fractions"
+#endif
+
+// Add d / 2 if 'bit' is set in the fraction, then halve.
+#define SENSOR_STEP(bit) r = (r + ((f & (bit)) ? d : 0)) >> 1
+
+static uint16_t raw;
+static uint16_t filtered;  // ADC counts << SENSOR_FILTER
+static uint16_t vcc;
+static uint16_t sample_ms;
+
+void sensorInit(void) {
+  DIDR0 |= (1 << ADC0D);  // Disable digital input buffer on the sensor pin.
+  ADMUX = SENSOR_MUX;
+  // Enable ADC with clk/128 (129kHz) and start the first conversion.
+  ADCSRA = (1 << ADEN) | (1 << ADSC) | (1 << ADPS2) | (1 << ADPS1) |
+           (1 << ADPS0);
+}
+
+static void sensor_update(void) {
+  static uint8_t primed = 0;
+  uint16_t us;
+
+  raw = ADC;
+  sample_ms = timebase_now_us(&us);
+  if (!primed) {
+    filtered = raw << SENSOR_FILTER;
+    primed = 1;
+  } else {
+    filtered += raw - (filtered >> SENSOR_FILTER);
+  }
+}
+
+void sensor_task(void) {
+  static uint8_t phase = 0;
+
+  if (capture_busy()) {
+    phase = 0;
+    return;
+  }
+
+  // A conversion takes ~100us, it is long done when the next tick comes.
+  if (ADCSRA & (1 << ADSC)) return;
+
+  if (++phase == SENSOR_VCC_EVERY) phase = 0;
+
+  switch (phase) {
+    case SENSOR_VCC_EVERY - 2:  // switch to the bandgap and let it settle
+      sensor_update();
+      ADMUX = SENSOR_VCC_MUX;
+      return;
+    case SENSOR_VCC_EVERY - 1:
+      break;
+    case 0:
+      if (ADC) vcc = SENSOR_BANDGAP_MV * 1024 / ADC;
+      ADMUX = SENSOR_MUX;
+      break;
+    default:
+      sensor_update();
+  }
+  ADCSRA |= (1 << ADSC);
+}
+
+uint16_t sensor_raw(void) { return raw; }
+
+uint16_t sensor_read(void) { return filtered >> SENSOR_FILTER; }
+
+uint16_t sensor_time(void) { return sample_ms; }
+
+uint16_t sensor_vcc(void) { return vcc; }
+
+// Not inlined so the build can report its cycle count, see the Makefile.
+__attribute__((noinline)) int16_t sensor_lookup(uint16_t adc) {
+  const int16_t *p = &sensor_table[adc >> SENSOR_TABLE_SHIFT];
+  uint8_t f = adc;
+  int16_t t0, d, r = 0;
+
+  t0 = pgm_read_word(p);
+  d = pgm_read_word(p + 1) - t0;
+  // r = d * f / 32 without a multiplication, |r| never exceeds |d|.
+  SENSOR_STEP(0x01);
+  SENSOR_STEP(0x02);
+  SENSOR_STEP(0x04);
+  SENSOR_STEP(0x08);
+  SENSOR_STEP(0x10);
+  return t0 + r;
+}
+
+// The filter keeps SENSOR_FILTER bits below one ADC count, which is more
+// than a degree C for a thermocouple. Interpolate those as well.
+int16_t sensor_temp(void) {
+  uint16_t adc = filtered >> SENSOR_FILTER;
+  uint8_t f = filtered & ((1 << SENSOR_FILTER) - 1);
+  int16_t t = sensor_lookup(adc);
+
+  if (f && adc < 1023) {
+    t += ((sensor_lookup(adc + 1) - t) * f) >> SENSOR_FILTER;
+  }
+  return t;
+}
@@ -0,0 +1,58 @@
+#ifndef __SENSOR_H__
+#define __SENSOR_H__
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * Tip temperature sensor and supply voltage sampled by the ADC.
+ *
+ * The sensor divider is connected to ADC0 (PB5). This requires the external
+ * reset to be disabled, see FUSEOPT_DISABLERESET in the bootloader
+ * configuration. Without a sensor the pin reads as a constant value.
+ *
+ * The supply voltage is derived from measuring the internal bandgap against
+ * VCC once every SENSOR_VCC_EVERY periods. The bandgap needs one period to
+ * settle after switching the multiplexer, the sensor isn't sampled then.
+ *
+ * Readings are converted to temperatures with the table in sensor_table.h,
+ * which is generated at build time by tools/sensorgen for the sensor type
+ * selected with 'make SENSOR=...'.
+ */
+
+#include <stdint.h>
+
+#define SENSOR_MUX 0       // ADMUX channel: ADC0 (PB5), VCC reference
+#define SENSOR_FILTER 3    // IIR filter constant: y += (x - y) / 2^n
+#define SENSOR_PERIOD_MS 10
+
+#define SENSOR_VCC_MUX 0x0C      // ADMUX channel: bandgap, VCC reference
+#define SENSOR_VCC_EVERY 10      // periods between supply measurements
+#define SENSOR_BANDGAP_MV 1100L  // nominal, calibrate per chip if needed
+
+// Start the ADC.
+void sensorInit(void);
+
+// Periodic task: read the last conversion and start the next one.
+void sensor_task(void);
+
+// Last unfiltered reading in ADC counts.
+uint16_t sensor_raw(void);
+
+// Filtered reading in ADC counts.
+uint16_t sensor_read(void);
+
+// Convert ADC counts to 0.1 degrees C by interpolating the sensor table.
+int16_t sensor_lookup(uint16_t adc);
+
+// Filtered reading in 0.1 degrees C, including the fraction of an ADC
+// count the filter keeps.
+int16_t sensor_temp(void);
+
+// Time of the last sample in ms (lower 16 bits of timebase_now()).
+uint16_t sensor_time(void);
+
+// Supply voltage in mV, 0 until the first measurement completed.
+uint16_t sensor_vcc(void);
+
+#endif  // __SENSOR_H__
@@ -0,0 +1,97 @@
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ */
+
+#include "standby.h"
+
+#include "cdc.h"
+#include "sensor.h"
+
+#define ST_ACTIVE 0
+#define ST_STANDBY 1
+#define ST_RECOVER 2
+
+uint8_t standby_timeout = STANDBY_TIMEOUT;
+
+static uint8_t state = ST_ACTIVE;
+static uint8_t saved_idx;
+static uint16_t idle_periods;  // periods the reading stayed within the band
+static uint16_t recover_periods;
+static uint16_t recovery_ms;
+static uint16_t ref;   // reading the active preset settled at
+static uint16_t last;  // reading of the previous period
+
+static void standby_wake(uint8_t cause) {
+  pwr_steps[PWR_IDX_STANDBY] = 0xFF;  // full power until recovered
+  state = ST_RECOVER;
+  recover_periods = 0;
+  report_event('W', cause);
+}
+
+static void standby_restore(void) {
+  pwr_idx = saved_idx;
+  state = ST_ACTIVE;
+  idle_periods = 0;
+}
+
+void standby_task(void) {
+  uint16_t r = sensor_read();
+
+  switch (state) {
+    case ST_ACTIVE:
+      if (standby_timeout == 0 || pwr_steps[pwr_idx] <= STANDBY_DUTY ||
+          r + STANDBY_BAND < ref || r > ref + STANDBY_BAND) {
+        ref = r;
+        idle_periods = 0;
+        break;
+      }
+      if (++idle_periods < standby_timeout * (10000 / STANDBY_PERIOD_MS)) {
+        break;
+      }
+      saved_idx = pwr_idx;
+      pwr_steps[PWR_IDX_STANDBY] = STANDBY_DUTY;
+      pwr_idx = PWR_IDX_STANDBY;
+      state = ST_STANDBY;
+      report_event('B', idle_periods / (1000 / STANDBY_PERIOD_MS));
+      break;
+
+    case ST_STANDBY:
+      if (r + STANDBY_DROP <= last) standby_wake(STANDBY_WAKE_LOAD);
+      break;
+
+    case ST_RECOVER:
+      ++recover_periods;
+      if (r + STANDBY_BAND >= ref ||
+          recover_periods >= STANDBY_RECOVERY_MS / STANDBY_PERIOD_MS) {
+        recovery_ms = recover_periods * STANDBY_PERIOD_MS;
+        report_event('R', recovery_ms);
+        standby_restore();
+      }
+      break;
+  }
+  last = r;
+}
+
+uint8_t standby_activity(void) {
+  switch (state) {
+    case ST_STANDBY:
+      standby_wake(STANDBY_WAKE_USER);
+      return 1;
+    case ST_RECOVER:
+      standby_restore();
+      return 1;
+  }
+  idle_periods = 0;
+  return 0;
+}
+
+void standby_reset(void) {
+  state = ST_ACTIVE;
+  idle_periods = 0;
+}
+
+uint8_t standby_state(void) { return state; }
+
+uint16_t standby_recovery_ms(void) { return recovery_ms; }
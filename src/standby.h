@@ -0,0 +1,58 @@
+#ifndef __STANDBY_H__
+#define __STANDBY_H__
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * Automatic standby.
+ *
+ * The heater is driven open-loop, so the thermal load is judged from the
+ * sensor: while the iron rests in its holder the reading settles at the
+ * level the active preset holds. If it stays within STANDBY_BAND for the
+ * standby timeout, the preset is replaced by STANDBY_DUTY. A button press or
+ * a sudden drop of the reading (tip touching a joint) ends standby. The
+ * heater then runs at full power until the reading is back at the level it
+ * had before standby and the previous preset is restored. An 'S' command
+ * ends standby right away with the new duty cycle.
+ *
+ * Transitions are reported to the host as events (see report_event()):
+ *   \B<idle seconds>     standby entered
+ *   \W<cause>            standby left, cause is one of STANDBY_WAKE_*
+ *   \R<milliseconds>     back at working temperature after wakeup
+ */
+
+#include <stdint.h>
+
+#define STANDBY_TIMEOUT 30     // default timeout in units of 10s, 0 = off
+#define STANDBY_DUTY 64        // duty cycle while in standby
+#define STANDBY_BAND 4         // ADC counts the reading may move while idle
+#define STANDBY_DROP 8         // ADC counts drop per period that means load
+#define STANDBY_RECOVERY_MS 20000  // upper limit for the full power boost
+#define STANDBY_PERIOD_MS 100
+
+#define STANDBY_WAKE_USER 1  // button or host command
+#define STANDBY_WAKE_LOAD 2  // drop of the sensor reading
+
+// Idle timeout in units of 10s, 0 disables standby.
+extern uint8_t standby_timeout;
+
+// Periodic task, runs every STANDBY_PERIOD_MS.
+void standby_task(void);
+
+// Signal user activity (button press). Leaves standby with a full power
+// boost, or ends a running boost and restores the previous preset.
+// Returns 1 if the activity was consumed by leaving standby or the boost.
+uint8_t standby_activity(void);
+
+// Leave standby without restoring the previous preset, used when the host
+// sets a new duty cycle. Restarts the idle timer.
+void standby_reset(void);
+
+// Current state: 0 active, 1 standby, 2 recovering.
+uint8_t standby_state(void);
+
+// Duration of the last recovery in milliseconds.
+uint16_t standby_recovery_ms(void);
+
+#endif  // __STANDBY_H__
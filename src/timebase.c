@@ -0,0 +1,46 @@
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ */
+
+#include "timebase.h"
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+volatile uint32_t timebase_ms;
+volatile uint16_t timebase_rem;
+
+uint32_t timebase_now(void) {
+  uint32_t ms;
+
+  cli();
+  ms = timebase_ms;
+  sei();
+  return ms;
+}
+
+uint32_t timebase_now_us(uint16_t *us) {
+  uint32_t ms, cyc;  // the remainder plus up to ~4ms of counts needs 32 bit
+  uint8_t cnt;
+
+  cli();
+  ms = timebase_ms;
+  cyc = timebase_rem;
+  cnt = TCNT0;
+  if ((TIFR & (1 << TOV0)) && cnt < 0x80) {  // overflow not yet serviced
+    ms += TIMEBASE_MS_PER_OVF;
+    cyc += TIMEBASE_REM_PER_OVF;
+  }
+  sei();
+
+  // TIMER0 runs at clk/256.
+  cyc += (uint16_t)cnt << 8;
+  while (cyc >= TIMEBASE_CYCLES_PER_MS) {
+    cyc -= TIMEBASE_CYCLES_PER_MS;
+    ++ms;
+  }
+  *us = cyc * 1000 / TIMEBASE_CYCLES_PER_MS;
+  return ms;
+}
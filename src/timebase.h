@@ -0,0 +1,46 @@
+#ifndef __TIMEBASE_H__
+#define __TIMEBASE_H__
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * 32 bit millisecond timebase.
+ *
+ * The time is advanced from TIMER0_OVF_vect (every 65536 CPU cycles) with
+ * the remainder carried over in CPU cycles, so it runs at the accuracy of
+ * the RC oscillator that the bootloader calibrated against the USB frame
+ * rate. It isn't disciplined to the bus: low-speed devices never see SOF
+ * tokens, and the keep-alives can't be counted with the USB interrupt on D+
+ * (USB_COUNT_SOF needs it on D-).
+ */
+
+#include <stdint.h>
+
+#define TIMEBASE_CYCLES_PER_MS (F_CPU / 1000)
+#define TIMEBASE_MS_PER_OVF (65536UL / TIMEBASE_CYCLES_PER_MS)
+#define TIMEBASE_REM_PER_OVF (65536UL % TIMEBASE_CYCLES_PER_MS)
+
+extern volatile uint32_t timebase_ms;
+extern volatile uint16_t timebase_rem;  // CPU cycles, < CYCLES_PER_MS
+
+// To be called from TIMER0_OVF_vect.
+static inline void timebase_tick(void) {
+  uint16_t rem = timebase_rem + TIMEBASE_REM_PER_OVF;
+  uint32_t ms = timebase_ms + TIMEBASE_MS_PER_OVF;
+
+  if (rem >= TIMEBASE_CYCLES_PER_MS) {
+    rem -= TIMEBASE_CYCLES_PER_MS;
+    ++ms;
+  }
+  timebase_rem = rem;
+  timebase_ms = ms;
+}
+
+// Current time in milliseconds.
+uint32_t timebase_now(void);
+
+// Current time in milliseconds and the fraction of the millisecond in us.
+uint32_t timebase_now_us(uint16_t *us);
+
+#endif  // __TIMEBASE_H__
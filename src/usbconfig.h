@@ -163,7 +163,14 @@ section at the end of this file).
  * proceed, do a return after doing your things. One possible application
  * (besides debugging) is to flash a status LED on each packet.
  */
-/* #define USB_RESET_HOOK(resetStarts)     if(!resetStarts){hadUsbReset();} */
+#ifndef __ASSEMBLER__
+extern unsigned char usbResetSeen; /* see cdc_watch_task() */
+#endif
+#define USB_RESET_HOOK(resetStarts) \
+  if (!resetStarts) {               \
+    usbConfiguration = 0;           \
+    usbResetSeen = 1;               \
+  }
 /* This macro is a hook if you need to know when an USB RESET occurs. It has
  * one parameter which distinguishes between the start of RESET state and its
  * end.
@@ -0,0 +1,54 @@
+# Authors: tickelton@gmail.com
+# Licenses: GNU GPL version 2. See License.txt.
+# Copyright: (c) 2021 tickelton@gmail.com
+#
+# Worst-case cycle count of a loop-free function in 'avr-objdump -d' output:
+#
+#   avr-objdump -d Soldering.elf | awk -v fn=sensor_lookup -f avrcycles.awk
+#
+# Every instruction is counted once with its longest timing on a device with
+# a 2 byte PC (ATtiny85), i.e. branches as taken. Calls and backward branches
+# are reported since their cost isn't included.
+
+BEGIN {
+  FS = "\t"
+  split("adiw sbiw ld ldd st std lds sts push pop cbi sbi rjmp ijmp" \
+        " cpse sbrc sbrs sbic sbis", two, " ")
+  for (i in two) cyc[two[i]] = 2
+  split("lpm rcall icall", three, " ")
+  for (i in three) cyc[three[i]] = 3
+  cyc["ret"] = 4
+  cyc["reti"] = 4
+}
+
+/^[0-9a-f]+ <.*>:$/ {
+  cur = $0
+  sub(/^[^<]*</, "", cur)
+  sub(/>:$/, "", cur)
+  next
+}
+
+cur == fn && NF >= 3 {
+  op = $3
+  gsub(/ /, "", op)
+  n++
+  if (op ~ /^br/) {
+    c = 2
+    if ($4 ~ /^\.-/) loops++
+  } else {
+    c = (op in cyc) ? cyc[op] : 1
+  }
+  if (op ~ /call$/) calls++
+  total += c
+}
+
+END {
+  if (!n) {
+    print fn ": not found" > "/dev/stderr"
+    exit 1
+  }
+  printf "%s: %d instructions, <= %d cycles", fn, n, total
+  if (calls) printf ", %d calls not included", calls
+  if (loops) printf ", %d backward branches", loops
+  printf "\n"
+}
@@ -0,0 +1,265 @@
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * Command round trip and throughput benchmark.
+ *
+ *   bench [-n samples] [-d seconds] [-o results] [-b baseline]
+ *         [-t percent] (tty | -e emulator)
+ *
+ * Measures the round trip latency distribution of '?', 'g', '00 s' and
+ * 'p', the sustained rate of sequential 'g' commands and the IN endpoint
+ * throughput for pipelined '?' replies. The reply of 'g' is exactly 8
+ * bytes long (echo included) and needs an extra empty packet to end the
+ * transfer, the reply of '00 s' fits a single short packet, the
+ * difference of their medians is reported as the cost of sendEmptyFrame.
+ *
+ * Results are written as 'key value' lines. Keys ending in '_us' are
+ * better when lower, all others when higher. If a baseline is given, the
+ * exit status is 2 if any value regressed by more than the tolerance.
+ * Latencies only count as regressed if they also grew by more than half a
+ * USB frame, below that the numbers are dominated by host scheduling.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "serial.h"
+
+#define CMD_WHO "usb_solderin_iron v0.1"
+#define WHO_LEN (2 + 2 + sizeof(CMD_WHO) - 1 + 2)
+#define PIPELINE 4
+#define MAX_RESULTS 32
+#define MIN_REGRESSION_US 500
+
+struct result {
+  char key[32];
+  double value;
+};
+
+static struct result results[MAX_RESULTS];
+static int n_results;
+
+static void add(const char *key, double value) {
+  if (n_results == MAX_RESULTS) return;
+  snprintf(results[n_results].key, sizeof(results[0].key), "%s", key);
+  results[n_results++].value = value;
+}
+
+static int cmp64(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+// Measure 'n' round trips of 'cmd', record p50/p99/max as 'lat_<name>_*'.
+// Returns the median or -1.
+static int64_t latency(int fd, const char *name, const char *cmd,
+                       size_t expect, int n) {
+  int64_t *t = malloc(n * sizeof(*t));
+  char buf[256], key[32];
+  int i;
+
+  if (!t) return -1;
+  for (i = 0; i < n; i++) {
+    t[i] = serial_exchange(fd, cmd, buf, expect);
+    if (t[i] < 0) {
+      fprintf(stderr, "%s: no reply\n", name);
+      free(t);
+      return -1;
+    }
+  }
+  qsort(t, n, sizeof(*t), cmp64);
+
+  snprintf(key, sizeof(key), "lat_%s_p50_us", name);
+  add(key, t[n / 2]);
+  snprintf(key, sizeof(key), "lat_%s_p99_us", name);
+  add(key, t[(n * 99) / 100]);
+  snprintf(key, sizeof(key), "lat_%s_max_us", name);
+  add(key, t[n - 1]);
+
+  i = t[n / 2];
+  free(t);
+  return i;
+}
+
+static int rate(int fd, int seconds) {
+  uint64_t start = serial_now_us(), end = start + seconds * 1000000ULL;
+  char buf[16];
+  long count = 0;
+
+  while (serial_now_us() < end) {
+    if (serial_exchange(fd, "g", buf, 8) < 0) return -1;
+    count++;
+  }
+  add("cmd_rate_per_s", count * 1e6 / (serial_now_us() - start));
+  return 0;
+}
+
+static int throughput(int fd, int n) {
+  char buf[PIPELINE * WHO_LEN];
+  uint64_t total = 0;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    // PIPELINE - 1 commands are sent ahead, the last one by the exchange.
+    if (write(fd, "?\r?\r?\r", 2 * (PIPELINE - 1)) != 2 * (PIPELINE - 1)) {
+      return -1;
+    }
+    int64_t t = serial_exchange(fd, "?", buf, sizeof(buf));
+    if (t < 0) return -1;
+    total += t;
+  }
+  add("in_bytes_per_s", (double)sizeof(buf) * n * 1e6 / total);
+  return 0;
+}
+
+static int compare(const char *path, double tolerance) {
+  char key[32];
+  double base;
+  int i, regressed = 0;
+  FILE *f = fopen(path, "r");
+
+  if (!f) {
+    perror(path);
+    return 1;
+  }
+  while (fscanf(f, "%31s %lf", key, &base) == 2) {
+    for (i = 0; i < n_results; i++) {
+      double v = results[i].value, change;
+      size_t len = strlen(key);
+      int lower_better = len > 3 && strcmp(key + len - 3, "_us") == 0;
+
+      if (strcmp(results[i].key, key) != 0) continue;
+      if (base == 0) break;
+      change = (v - base) / base * 100;
+      if (lower_better ? change > tolerance && v - base > MIN_REGRESSION_US
+                       : -change > tolerance) {
+        printf("REGRESSION %-24s %10.0f -> %10.0f (%+.1f%%)\n", key, base, v,
+               change);
+        regressed = 1;
+      }
+      break;
+    }
+  }
+  fclose(f);
+  return regressed ? 2 : 0;
+}
+
+// Start the emulator and return the pseudo terminal it prints.
+static pid_t spawn(const char *emu, char *tty, size_t len) {
+  int p[2];
+  pid_t pid;
+  FILE *f;
+
+  if (pipe(p)) return -1;
+  pid = fork();
+  if (pid == 0) {
+    dup2(p[1], 1);
+    close(p[0]);
+    execl(emu, emu, (char *)NULL);
+    _exit(1);
+  }
+  close(p[1]);
+  f = fdopen(p[0], "r");
+  if (pid < 0 || !f || !fgets(tty, len, f)) return -1;
+  tty[strcspn(tty, "\n")] = '\0';
+  return pid;
+}
+
+int main(int argc, char **argv) {
+  const char *out = NULL, *baseline = NULL, *emu = NULL;
+  double tolerance = 20;
+  int opt, fd, i, n = 200, seconds = 2, status = 0;
+  int64_t get, set;
+  char tty[256], buf[64];
+  pid_t pid = 0;
+  FILE *f = stdout;
+
+  while ((opt = getopt(argc, argv, "n:d:o:b:t:e:")) != -1) {
+    switch (opt) {
+      case 'n':
+        n = atoi(optarg);
+        break;
+      case 'd':
+        seconds = atoi(optarg);
+        break;
+      case 'o':
+        out = optarg;
+        break;
+      case 'b':
+        baseline = optarg;
+        break;
+      case 't':
+        tolerance = atof(optarg);
+        break;
+      case 'e':
+        emu = optarg;
+        break;
+      default:
+        goto usage;
+    }
+  }
+  if (n < 1 || (emu == NULL) == (optind == argc)) goto usage;
+
+  if (emu) {
+    pid = spawn(emu, tty, sizeof(tty));
+    if (pid < 0) {
+      fprintf(stderr, "%s: failed to start\n", emu);
+      return 1;
+    }
+  } else {
+    snprintf(tty, sizeof(tty), "%s", argv[optind]);
+  }
+
+  fd = serial_open(tty);
+  if (fd < 0) {
+    perror(tty);
+    status = 1;
+    goto done;
+  }
+
+  // Turn the heater off and flush anything pending.
+  serial_cmd(fd, "00 s", buf, sizeof(buf), 0, 100);
+
+  if (latency(fd, "who", "?", WHO_LEN, n) < 0 ||
+      (get = latency(fd, "get", "g", 8, n)) < 0 ||
+      (set = latency(fd, "set", "00 s", 7, n)) < 0 ||
+      latency(fd, "phase", "p", 11, n) < 0 || rate(fd, seconds) < 0 ||
+      throughput(fd, n / 10 + 1) < 0) {
+    status = 1;
+    goto done;
+  }
+  add("zlp_extra_us", get > set ? get - set : 0);
+
+  if (out && !(f = fopen(out, "w"))) {
+    perror(out);
+    status = 1;
+    goto done;
+  }
+  for (i = 0; i < n_results; i++) {
+    fprintf(f, "%s %.0f\n", results[i].key, results[i].value);
+  }
+  if (f != stdout) fclose(f);
+
+  if (baseline) status = compare(baseline, tolerance);
+
+done:
+  if (pid > 0) {
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+  }
+  return status;
+
+usage:
+  fprintf(stderr,
+          "usage: %s [-n samples] [-d seconds] [-o results] [-b baseline]\n"
+          "          [-t percent] (tty | -e emulator)\n",
+          argv[0]);
+  return 1;
+}
@@ -0,0 +1,154 @@
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * Arm the capture, wait for it to complete and decode the dump.
+ * See src/capture.h for the dump format.
+ *
+ *   capdump [-a mask] [-q rate] [-l level] [-w seconds] tty
+ *
+ * Without -a the last completed capture is dumped. The samples are
+ * printed as 'index,time_us,value' with time 0 at the trigger.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "serial.h"
+
+#define F_CPU 16500000.0
+#define SAMPLE_US (13 * 128 / F_CPU * 1e6)  // free running ADC at clk/128
+
+static int hexbyte(const char *p) {
+  unsigned v;
+
+  if (sscanf(p, "%2x", &v) != 1) return -1;
+  return (int)v;
+}
+
+// Decode the dump lines in 'text'. Returns the number of samples.
+static int decode(const char *text, int *samples, int max, int *rate,
+                  int *trig) {
+  const char *line = text;
+  int n = -1, count = 0;
+  unsigned v = 0, shift = 0;
+
+  while (line && *line) {
+    const char *end = strchr(line, '\n');
+    size_t len = end ? (size_t)(end - line) : strlen(line);
+
+    if (line[0] == '=' && len >= 7) {
+      count = hexbyte(line + 1);
+      *rate = hexbyte(line + 3);
+      *trig = hexbyte(line + 5);
+      n = 0;
+    } else if (line[0] == '#' && n >= 0) {
+      size_t i;
+
+      if (len == 1) break;  // end of dump
+      for (i = 1; i + 1 < len; i += 2) {
+        int b = hexbyte(line + i);
+
+        v |= (unsigned)(b & 0x7F) << shift;
+        shift += 7;
+        if (b & 0x80) continue;
+
+        if (n < max) {
+          // zigzag decode the delta
+          int d = (v & 1) ? -(int)((v + 1) >> 1) : (int)(v >> 1);
+
+          samples[n] = n == 0 ? (int)v : samples[n - 1] + d;
+          n++;
+        }
+        v = 0;
+        shift = 0;
+      }
+    }
+    line = end ? end + 1 : NULL;
+  }
+
+  if (n != count) {
+    fprintf(stderr, "expected %d samples, decoded %d\n", count, n);
+  }
+  return n;
+}
+
+int main(int argc, char **argv) {
+  int opt, fd, i, n, rate = 1, trig = 0, wait = 10;
+  int arm = -1, q = -1, level = -1;
+  int samples[256];
+  char reply[2048], cmd[16];
+
+  while ((opt = getopt(argc, argv, "a:q:l:w:")) != -1) {
+    switch (opt) {
+      case 'a':
+        arm = (int)strtol(optarg, NULL, 0);
+        break;
+      case 'q':
+        q = (int)strtol(optarg, NULL, 0);
+        break;
+      case 'l':
+        level = (int)strtol(optarg, NULL, 0);
+        break;
+      case 'w':
+        wait = atoi(optarg);
+        break;
+      default:
+        goto usage;
+    }
+  }
+  if (optind != argc - 1) goto usage;
+
+  fd = serial_open(argv[optind]);
+  if (fd < 0) {
+    perror(argv[optind]);
+    return 1;
+  }
+
+  if (q >= 0) {
+    snprintf(cmd, sizeof(cmd), "%02X q", q & 0xFF);
+    serial_cmd(fd, cmd, reply, sizeof(reply), 0, 50);
+  }
+  if (level >= 0) {
+    snprintf(cmd, sizeof(cmd), "%02X l", level & 0xFF);
+    serial_cmd(fd, cmd, reply, sizeof(reply), 0, 50);
+  }
+  if (arm >= 0) {
+    snprintf(cmd, sizeof(cmd), "%02X a", arm & 0xFF);
+    serial_cmd(fd, cmd, reply, sizeof(reply), 0, 50);
+
+    for (i = 0; i < wait * 10; i++) {
+      if (serial_cmd(fd, "a", reply, sizeof(reply), 1, 0) == 1 &&
+          strtol(reply, NULL, 16) == 3) {
+        break;
+      }
+      usleep(100000);
+    }
+    if (i == wait * 10) {
+      fprintf(stderr, "no trigger within %d seconds\n", wait);
+      return 1;
+    }
+  }
+
+  if (serial_cmd(fd, "x", reply, sizeof(reply), 0, 200) < 1 ||
+      reply[0] != '=') {
+    fprintf(stderr, "nothing captured\n");
+    return 1;
+  }
+
+  n = decode(reply, samples, sizeof(samples) / sizeof(samples[0]), &rate,
+             &trig);
+  printf("index,time_us,value\n");
+  for (i = 0; i < n; i++) {
+    printf("%d,%.0f,%d\n", i, (i - trig) * rate * SAMPLE_US, samples[i]);
+  }
+  return 0;
+
+usage:
+  fprintf(stderr, "usage: %s [-a mask] [-q rate] [-l level] [-w seconds] tty\n",
+          argv[0]);
+  return 1;
+}
@@ -0,0 +1,204 @@
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * Closed loop temperature control from the host.
+ *
+ *   hostloop [-r hz] [-d seconds] [-l lease_ms] [-t temp] [-k gain]
+ *            (tty | -e emulator)
+ *
+ * Runs a proportional controller at a fixed rate. Every period it sends
+ * 'LL DD w' with the duty computed from the temperature of the previous
+ * reply, so the iron falls back to its safe preset if the host stops
+ * renewing the lease. 'temp' is in degrees Celsius, 'gain' in duty steps
+ * per degree. Prints the host round trip and the latency the device
+ * measured from sample to actuation (p50/p99/max), the number of periods
+ * that overran and the number of lease expiries during the run.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "serial.h"
+
+#define TICK_MS 10  // lease unit of the firmware
+
+static int cmp64(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+static void report(const char *name, const char *unit, int64_t *t, int n) {
+  qsort(t, n, sizeof(*t), cmp64);
+  printf("%-10s p50 %6lld  p99 %6lld  max %6lld %s\n", name,
+         (long long)t[n / 2], (long long)t[(n * 99) / 100],
+         (long long)t[n - 1], unit);
+}
+
+static int expiries(int fd) {
+  char buf[64];
+  unsigned lease, exp;
+
+  if (serial_cmd(fd, "w", buf, sizeof(buf), 1, 100) != 1 ||
+      sscanf(buf, "%x %x", &lease, &exp) != 2) {
+    return -1;
+  }
+  return exp;
+}
+
+// Start the emulator and return the pseudo terminal it prints.
+static pid_t spawn(const char *emu, char *tty, size_t len) {
+  int p[2];
+  pid_t pid;
+  FILE *f;
+
+  if (pipe(p)) return -1;
+  pid = fork();
+  if (pid == 0) {
+    dup2(p[1], 1);
+    close(p[0]);
+    execl(emu, emu, (char *)NULL);
+    _exit(1);
+  }
+  close(p[1]);
+  f = fdopen(p[0], "r");
+  if (pid < 0 || !f || !fgets(tty, len, f)) return -1;
+  tty[strcspn(tty, "\n")] = '\0';
+  return pid;
+}
+
+int main(int argc, char **argv) {
+  const char *emu = NULL;
+  int opt, fd, n, i = 0, hz = 20, seconds = 10, lease_ms = 250, status = 0;
+  int overruns = 0, exp0, exp1;
+  double target = 300, gain = 8, duty;
+  int64_t *rtt = NULL, *lat = NULL;
+  uint64_t period, next, start;
+  unsigned reading, temp, l;
+  char tty[256], cmd[16], buf[64];
+  pid_t pid = 0;
+
+  while ((opt = getopt(argc, argv, "r:d:l:t:k:e:")) != -1) {
+    switch (opt) {
+      case 'r':
+        hz = atoi(optarg);
+        break;
+      case 'd':
+        seconds = atoi(optarg);
+        break;
+      case 'l':
+        lease_ms = atoi(optarg);
+        break;
+      case 't':
+        target = atof(optarg);
+        break;
+      case 'k':
+        gain = atof(optarg);
+        break;
+      case 'e':
+        emu = optarg;
+        break;
+      default:
+        goto usage;
+    }
+  }
+  if (hz < 1 || hz > 1000 || seconds < 1 || lease_ms < TICK_MS ||
+      lease_ms > 255 * TICK_MS || (emu == NULL) == (optind == argc)) {
+    goto usage;
+  }
+  if (lease_ms * hz < 1000) {
+    fprintf(stderr, "warning: lease shorter than the control period\n");
+  }
+
+  if (emu) {
+    pid = spawn(emu, tty, sizeof(tty));
+    if (pid < 0) {
+      fprintf(stderr, "%s: failed to start\n", emu);
+      return 1;
+    }
+  } else {
+    snprintf(tty, sizeof(tty), "%s", argv[optind]);
+  }
+
+  fd = serial_open(tty);
+  n = hz * seconds;
+  rtt = malloc(n * sizeof(*rtt));
+  lat = malloc(n * sizeof(*lat));
+  if (fd < 0 || !rtt || !lat) {
+    perror(tty);
+    status = 1;
+    goto done;
+  }
+
+  // Turn the heater off and flush anything pending.
+  serial_cmd(fd, "00 s", buf, sizeof(buf), 0, 100);
+  if ((exp0 = expiries(fd)) < 0) {
+    fprintf(stderr, "%s: 'w' not supported\n", tty);
+    status = 1;
+    goto done;
+  }
+
+  duty = 0;
+  period = 1000000 / hz;
+  next = serial_now_us();
+  for (i = 0; i < n; i++) {
+    int64_t wait = (int64_t)(next - serial_now_us());
+
+    if (wait > 0) {
+      usleep(wait);
+    } else if (i) {
+      overruns++;
+    }
+    next += period;
+
+    snprintf(cmd, sizeof(cmd), "%02X %02X w", lease_ms / TICK_MS,
+             (unsigned)duty);
+    start = serial_now_us();
+    if (serial_cmd(fd, cmd, buf, sizeof(buf), 1, 100) != 1 ||
+        sscanf(buf, "%x %x %x", &reading, &temp, &l) != 3) {
+      fprintf(stderr, "%s: no reply\n", cmd);
+      status = 1;
+      break;
+    }
+    rtt[i] = serial_now_us() - start;
+    lat[i] = l;
+
+    duty = (target - (int16_t)temp / 10.0) * gain;
+    if (duty < 0) duty = 0;
+    if (duty > 0xFF) duty = 0xFF;
+  }
+
+  exp1 = expiries(fd);
+  serial_cmd(fd, "00 s", buf, sizeof(buf), 0, 100);
+
+  // The first sample has no previous lease to measure against.
+  if (i > 1) {
+    report("round trip", "us", rtt, i);
+    report("latency", "ms", lat + 1, i - 1);
+  }
+  printf("periods %d  overruns %d  expiries %d\n", i, overruns,
+         exp1 < 0 ? -1 : (uint8_t)(exp1 - exp0));
+  if (exp1 != exp0) status = 2;
+
+done:
+  free(rtt);
+  free(lat);
+  if (pid > 0) {
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+  }
+  return status;
+
+usage:
+  fprintf(stderr,
+          "usage: %s [-r hz] [-d seconds] [-l lease_ms] [-t temp] [-k gain]\n"
+          "          (tty | -e emulator)\n",
+          argv[0]);
+  return 1;
+}
@@ -0,0 +1,244 @@
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * Pseudo terminal stand-in for the soldering iron.
+ *
+ * Implements the basic commands ('?', 'g', '## s', 'p', '## p'), the
+ * telemetry commands ('d', 'v', 'b', with a reading proportional to the
+ * duty cycle and a constant 5V supply) and leased duty cycles ('LL DD w',
+ * the lease isn't enforced). The parser is a copy of cdc_rx_char() with the
+ * same echo behaviour, keep the two in sync. The output is paced like the
+ * low-speed bulk IN endpoint: one packet of at most 8 bytes per 1ms frame,
+ * plus an empty packet after a transfer that ended on a full packet
+ * (sendEmptyFrame).
+ *
+ * The name of the pseudo terminal is printed on stdout, the emulator runs
+ * until it is terminated.
+ */
+
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 600
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CMD_WHO "usb_solderin_iron v0.1"
+#define TBUF_SZ 128
+#define TBUF_MSK (TBUF_SZ - 1)
+#define FRAME_US 1000
+#define PACKET 8
+
+static char tbuf[TBUF_SZ];
+static unsigned char twcnt, trcnt, send_empty;
+static char rbuf[8];
+static unsigned char rcnt, val, val2, got_val;
+static unsigned long long lease_us;
+static unsigned char duty, phase;
+
+static unsigned long long now_us(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static unsigned now_ms(void) { return (unsigned)(now_us() / 1000); }
+
+static void out_char(char c) {
+  tbuf[twcnt++] = c;
+  twcnt &= TBUF_MSK;
+}
+
+static void out_str(const char *s) {
+  while (*s) out_char(*s++);
+}
+
+static void out_hex8(unsigned char v) {
+  static const char hex[] = "0123456789ABCDEF";
+
+  out_char(hex[v >> 4]);
+  out_char(hex[v & 0x0f]);
+}
+
+static void out_hex16(unsigned v) {
+  out_hex8(v >> 8);
+  out_hex8(v & 0xff);
+}
+
+static int not_hex_digit(char d) {
+  return d < '0' || d > 'F' || (d > '9' && d < 'A');
+}
+
+static unsigned char h2u(char h) {
+  h -= '0';
+  if (h > 9) h -= 7;
+  return h;
+}
+
+// Copy of the state machine in cdc_rx_char().
+static void rx(char c) {
+  out_char(c);
+  if (c > 0x20) {
+    if ('a' <= c && c <= 'z') c -= 0x20;
+    rbuf[rcnt++] = c;
+    rcnt &= 7;
+    return;
+  }
+  if (rcnt == 0) return;
+
+  if (rcnt == 1) {
+    switch (rbuf[0]) {
+      case '?':
+        out_str("\r\n" CMD_WHO "\r\n");
+        break;
+      case 'G':
+        out_str("\r\n");
+        out_hex8(duty);
+        out_str("\r\n");
+        break;
+      case 'S':
+        if (!got_val) {
+          out_str("\r\n!\r\n");
+          break;
+        }
+        duty = val;
+        got_val = 0;
+        out_str("\r\n");
+        break;
+      case 'D':
+        out_str("\r\n");
+        out_hex16(now_ms() >> 16);
+        out_hex16(now_ms() & 0xffff);
+        out_char(' ');
+        out_hex8(duty);
+        out_char(' ');
+        out_hex16(duty * 2);
+        out_char(' ');
+        out_hex16(250 + duty * 15);
+        out_str("\r\n");
+        break;
+      case 'V':
+        out_str("\r\n1388 0100 ");
+        out_hex8(duty);
+        out_str("\r\n");
+        break;
+      case 'B':
+        out_str("\r\n00 1E 0000\r\n");
+        break;
+      case 'W':
+        if (!got_val) {
+          out_str("\r\n00 00 0000 0000\r\n");
+          break;
+        }
+        if (got_val != 2 || val2 == 0) {
+          out_str("\r\n!\r\n");
+          got_val = 0;
+          break;
+        }
+        duty = val;
+        got_val = 0;
+        out_str("\r\n");
+        out_hex16(duty * 2);
+        out_char(' ');
+        out_hex16(250 + duty * 15);
+        out_char(' ');
+        out_hex16(lease_us && now_us() - lease_us < 65535000
+                      ? (now_us() - lease_us) / 1000
+                      : lease_us ? 0xFFFF : 0);
+        out_str("\r\n");
+        lease_us = now_us();
+        break;
+      case 'P':
+        out_str("\r\n");
+        if (got_val) {
+          phase = val;
+          got_val = 0;
+        } else {
+          out_hex8(phase);
+          out_char(' ');
+          out_hex8((unsigned char)(clock() >> 12));
+          out_str("\r\n");
+        }
+        break;
+      default:
+        out_str("\r\n!\r\n");
+    }
+  } else if (rcnt == 2 && !not_hex_digit(rbuf[0]) &&
+             !not_hex_digit(rbuf[1])) {
+    val2 = val;
+    val = (h2u(rbuf[0]) << 4) | h2u(rbuf[1]);
+    got_val = got_val ? 2 : 1;
+  } else {
+    out_str("\r\n!\r\n");
+  }
+  rcnt = 0;
+}
+
+// Transmit one packet, like the TX part of cdc_poll().
+static void tx(int fd) {
+  unsigned char tlen;
+
+  if (twcnt == trcnt && !send_empty) return;
+
+  tlen = twcnt >= trcnt ? (twcnt - trcnt) : (TBUF_SZ - trcnt);
+  if (tlen > PACKET) tlen = PACKET;
+  if (tlen && write(fd, tbuf + trcnt, tlen) != tlen) exit(1);
+  trcnt = (trcnt + tlen) & TBUF_MSK;
+  send_empty = (tlen == PACKET && twcnt == trcnt) ? 1 : 0;
+}
+
+int main(void) {
+  struct termios tio;
+  struct pollfd pfd;
+  unsigned long long next;
+  int master, slave;
+  char *name;
+
+  master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) || unlockpt(master)) {
+    perror("posix_openpt");
+    return 1;
+  }
+  name = ptsname(master);
+
+  // Keep the slave open so the master doesn't see a hangup between clients.
+  slave = open(name, O_RDWR | O_NOCTTY);
+  if (slave < 0 || tcgetattr(slave, &tio)) {
+    perror(name);
+    return 1;
+  }
+  cfmakeraw(&tio);
+  tcsetattr(slave, TCSANOW, &tio);
+
+  printf("%s\n", name);
+  fflush(stdout);
+
+  pfd.fd = master;
+  pfd.events = POLLIN;
+  next = now_us() + FRAME_US;
+
+  for (;;) {
+    long long wait = (long long)(next - now_us());
+    char buf[PACKET];
+    ssize_t i, n;
+
+    if (poll(&pfd, 1, wait > 0 ? (int)((wait + 999) / 1000) : 0) > 0) {
+      // One OUT packet per frame at most.
+      n = read(master, buf, sizeof(buf));
+      if (n <= 0) return 0;
+      for (i = 0; i < n; i++) rx(buf[i]);
+    }
+    if (now_us() >= next) {
+      tx(master);
+      next += FRAME_US;
+    }
+  }
+}
@@ -0,0 +1,460 @@
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * Closed-loop benchmark of the firmware control code on a simulated iron.
+ *
+ *   ironsim [-w workload] [-c open|p] [-k gain] [-b slope,duty,boost,decay]
+ *           [-s seed] [-o results] [-v]
+ *
+ * heater.c, standby.c, sensor.c, meter.c, nvm.c and reheat.c are compiled
+ * for the host (see tools/native) and driven as on the device: heater_pwm()
+ * on every TIMER0 overflow and the tasks at the periods main.c schedules
+ * them with. The ADC is fed from the thermal model in tools/plant.h through
+ * the inverse of sensor_lookup(), the bandgap channel from the supply
+ * voltage.
+ *
+ * The workload is a string or a file of commands separated by ';' or
+ * newlines:
+ *
+ *   preset N       select pwr_steps[N] as the button does; with -c p
+ *                  hold SIM_HEADROOM below the temperature it settles at
+ *   target T       hold T degrees C with a P controller on the host,
+ *                  renewing a lease with heater_set() like tools/hostloop
+ *   wait S         S seconds in the holder
+ *   joints N S G   N joints of S seconds, G seconds apart
+ *   button         press the button
+ *
+ * The setpoint is the core temperature the active preset settles at, or
+ * the target. Results are 'key value' lines like tools/bench writes:
+ * time to reach the setpoint within SIM_BAND, overshoot after that, and
+ * per joint the droop, the time from the end of the joint until the
+ * setpoint is reached again and the heater energy from the start of the
+ * joint until then. Temperatures are those of the heater core, without
+ * sensor noise. The joint contact detection of reheat.h is measured against
+ * the actual contact: its latency, the joints it missed and detections
+ * outside of joints. -b sets its parameters, e.g. '-b 15,0,0,8' detects
+ * without a boost for comparison.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "cdc.h"
+#include "heater.h"
+#include "meter.h"
+#include "nvm.h"
+#include "plant.h"
+#include "reheat.h"
+#include "sensor.h"
+#include "standby.h"
+
+#define SIM_BAND 5.0      // degrees C around the setpoint
+#define SIM_HEADROOM 20   // -c p: degrees C below the preset
+#define SIM_LEASE_MS 50   // control period in 'target' mode
+#define SIM_LEASE_TICKS 25
+#define SIM_DEFAULT_WORKLOAD \
+  "preset 2; wait 300; joints 10 3 5; wait 400; joints 5 3 5; wait 120"
+#define OVF_S (65536.0 / F_CPU)
+
+// Registers of tools/native/avr/io.h.
+volatile uint8_t ADMUX, ADCSRA, DIDR0;
+volatile uint16_t ADC;
+
+// Globals of src/cdc.c.
+uint8_t pwr_steps[PWR_STEPS_LEN + 2] = MODEL_PWR_STEPS;
+uint8_t pwr_idx;
+uint8_t pwm_phase;
+
+// TIMER0 overflow counter of src/main.c.
+volatile uint8_t timer_counter;
+
+// Stand-ins for the parts of the firmware that aren't simulated.
+void capture_trigger(uint8_t src) {}
+uint8_t capture_busy(void) { return 0; }
+
+static plant_t plant;
+static int16_t temp_of[1024];  // sensor_lookup() for every ADC code
+static uint8_t on;
+static uint32_t now_ms;
+static double tick_due;
+static int verbose;
+
+// Control mode: preset index or target temperature (0.1 C, -1 = preset).
+static uint8_t preset;
+static int target = -1;
+static double gain = 8;
+static int host_control;
+static int partial;  // PWM period in progress when the preset changed
+
+// Metrics.
+static double setpoint = NAN;
+static double start_time, reached_time = -1, overshoot;
+static int joints;
+static double joint_end, joint_energy, joint_min;
+static int in_joint, recovering, finished, recovered;
+static double recovery_sum, recovery_max, energy_sum, droop_sum, droop_max;
+static double joint_start;
+static int detected, false_detections;
+static uint16_t joints_seen;
+static double latency_sum, latency_max;
+
+uint32_t timebase_now(void) { return now_ms; }
+
+uint32_t timebase_now_us(uint16_t *us) {
+  *us = 0;
+  return now_ms;
+}
+
+void report_event(uchar code, uint16_t val) {
+  if (verbose) printf("%9.3f \\%c%04X\n", plant.time, code, val);
+}
+
+static uint16_t adc_of(double t) {
+  int lo = 0, hi = 1023, target10 = (int)lround(t * 10);
+
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+
+    if (temp_of[mid] < target10) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// Called at the end of every PWM period with its on-time in steps. The
+// compensated duty cycle follows the VCC measurement, which sees the sag
+// while the heater is on, so the setpoint of a preset is taken from the
+// on-time actually delivered, averaged over ~8 periods. It is held during
+// joints and their recovery, the reheat boost isn't part of the preset.
+static double steady(double duty) {
+  double v = plant_vcc(&plant, 1);
+
+  return plant_steady(&plant.p, v * v / plant.p.heater_ohm * duty / 256);
+}
+
+static void update_setpoint(uint8_t steps) {
+  static double avg;
+  double duty = (unsigned)steps << HEATER_PWM_SHIFT;  // 1/256 of the period
+
+  if (target >= 0) {
+    setpoint = target / 10.0;
+  } else if (pwr_idx == preset && partial) {
+    partial = 0;  // started before the preset was selected
+  } else if (pwr_idx == preset && !in_joint && !recovering) {
+    avg = isnan(setpoint) ? duty : avg + (duty - avg) / 8;
+    setpoint = steady(avg);
+  }
+}
+
+// Start measuring the way to a new setpoint.
+static void new_setpoint(void) {
+  setpoint = NAN;
+  partial = 1;
+  start_time = plant.time;
+  reached_time = -1;
+  overshoot = 0;
+}
+
+// Close the statistics of the current joint, at the end of its recovery
+// or when the next joint starts first.
+static void joint_done(int ok) {
+  double now = plant.time, r = now - joint_end,
+         e = plant.energy - joint_energy, droop = setpoint - joint_min;
+
+  recovering = 0;
+  finished++;
+  droop_sum += droop;
+  if (droop > droop_max) droop_max = droop;
+  energy_sum += e;
+  if (ok) {
+    recovered++;
+    recovery_sum += r;
+    if (r > recovery_max) recovery_max = r;
+  }
+  if (verbose) {
+    printf("%9.3f joint %d: droop %.1f C, ", now, joints, droop);
+    if (ok) {
+      printf("recovery %.2f s, %.1f J\n", r, e);
+    } else {
+      printf("not recovered, %.1f J\n", e);
+    }
+  }
+}
+
+static void track(void) {
+  double t = plant.core, now = plant.time;
+
+  if (isnan(setpoint)) return;
+  if (reached_time < 0 && fabs(t - setpoint) <= SIM_BAND) reached_time = now;
+  if (reached_time >= 0 && !joints && t - setpoint > overshoot) {
+    overshoot = t - setpoint;
+  }
+
+  if ((in_joint || recovering) && t < joint_min) joint_min = t;
+  if (recovering && t >= setpoint - SIM_BAND) joint_done(1);
+}
+
+// Match the detections of reheat.c with the joints.
+static void track_detection(void) {
+  const reheat_t *r = reheat_get();
+  double lat = plant.time - joint_start;
+
+  if (r->joints == joints_seen) return;
+  joints_seen = r->joints;
+  if (!in_joint || joint_start < 0) {
+    false_detections++;
+    if (verbose) printf("%9.3f false detection\n", plant.time);
+    return;
+  }
+  joint_start = -1;  // count one detection per joint
+  detected++;
+  latency_sum += lat;
+  if (lat > latency_max) latency_max = lat;
+  if (verbose) {
+    printf("%9.3f joint %d detected after %.0f ms (firmware %u ms)\n",
+           plant.time, joints, lat * 1e3, r->latency_ms);
+  }
+}
+
+static void tick(void) {
+  static uint8_t n;
+
+  n++;
+  // Conversion started in the previous tick is done.
+  if (ADMUX == SENSOR_VCC_MUX) {
+    ADC = SENSOR_BANDGAP_MV * 1024 / (uint16_t)(plant_vcc(&plant, on) * 1e3);
+  } else {
+    ADC = adc_of(plant_sensor(&plant));
+  }
+  ADCSRA &= (uint8_t) ~(1 << ADSC);
+  sensor_task();
+  heater_task();
+  nvm_task();
+  if (n % (STANDBY_PERIOD_MS / 10) == 0) standby_task();
+  if (n % (METER_PERIOD_MS / 10) == 0) meter_task();
+  if (target >= 0 && n % (SIM_LEASE_MS / 10) == 0) {
+    int d = (target - sensor_temp()) * gain / 10;
+
+    standby_reset();
+    heater_set(d < 0 ? 0 : d > 0xFF ? 0xFF : d, SIM_LEASE_TICKS);
+  }
+  track();
+  track_detection();
+}
+
+// Run for 's' seconds: one plant step per TIMER0 overflow, the 10ms tasks
+// in between.
+static void run(double s) {
+  static uint8_t steps;
+  double end = plant.time + s;
+
+  while (plant.time < end) {
+    uint8_t pos = heater_pos(timer_counter, pwm_phase);
+
+    if (pos < (1 << HEATER_PWM_SHIFT)) {
+      update_setpoint(steps);
+      steps = 0;
+    }
+    on = heater_pwm(pos, on);
+    if (on) {
+      meter_steps++;
+      steps++;
+    }
+    timer_counter++;
+    plant_step(&plant, on, OVF_S);
+    now_ms = plant.time * 1000;
+    while (plant.time >= tick_due) {
+      tick_due += 0.01;
+      tick();
+    }
+  }
+}
+
+static void joint(double s) {
+  if (recovering) joint_done(0);
+  joints++;
+  joint_start = plant.time;
+  joint_energy = plant.energy;
+  joint_min = plant.core;
+  in_joint = 1;
+  plant_load(&plant, 1);
+  run(s);
+  plant_load(&plant, 0);
+  in_joint = 0;
+  recovering = 1;
+  joint_end = plant.time;
+}
+
+static int workload(char *w) {
+  char *cmd, *save;
+
+  for (cmd = strtok_r(w, ";\n", &save); cmd;
+       cmd = strtok_r(NULL, ";\n", &save)) {
+    char op[16];
+    double a = 0, b = 0, c = 0;
+    int n = sscanf(cmd, "%15s %lf %lf %lf", op, &a, &b, &c);
+    int i;
+
+    if (n < 1) continue;
+    if (strcmp(op, "preset") == 0 && n == 2 && a >= 0 && a < PWR_STEPS_LEN) {
+      preset = a;
+      target = -1;
+      pwr_idx = preset;
+      standby_reset();
+      new_setpoint();
+      if (host_control) {
+        // Hold the temperature the preset settles at, less some headroom.
+        heater_task();
+        target = (steady(heater_duty) - SIM_HEADROOM) * 10;
+      }
+    } else if (strcmp(op, "target") == 0 && n == 2) {
+      target = a * 10;
+      new_setpoint();
+    } else if (strcmp(op, "wait") == 0 && n == 2) {
+      run(a);
+    } else if (strcmp(op, "joints") == 0 && n == 4) {
+      for (i = 0; i < a; i++) {
+        joint(b);
+        run(c);
+      }
+    } else if (strcmp(op, "button") == 0 && n == 1) {
+      if (!standby_activity() && ++pwr_idx >= PWR_STEPS_LEN) pwr_idx = 0;
+    } else {
+      fprintf(stderr, "bad workload command: %s\n", cmd);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static char *load(const char *arg) {
+  FILE *f = fopen(arg, "r");
+  char *buf;
+  long len;
+
+  if (!f) return strdup(arg);
+  fseek(f, 0, SEEK_END);
+  len = ftell(f);
+  rewind(f);
+  buf = calloc(1, len + 1);
+  if (buf && fread(buf, 1, len, f) != (size_t)len) len = 0;
+  fclose(f);
+  return buf;
+}
+
+int main(int argc, char **argv) {
+  const char *w = SIM_DEFAULT_WORKLOAD, *out = NULL, *mode = "open";
+  plant_params_t params;
+  uint64_t seed = 1;
+  struct timeval t0, t1;
+  double wall;
+  char *script;
+  FILE *f = stdout;
+  int opt, i;
+
+  while ((opt = getopt(argc, argv, "w:c:k:b:s:o:v")) != -1) {
+    switch (opt) {
+      case 'w':
+        w = optarg;
+        break;
+      case 'c':
+        mode = optarg;
+        break;
+      case 'k':
+        gain = atof(optarg);
+        break;
+      case 'b':
+        if (sscanf(optarg, "%hhu,%hhu,%hhu,%hhu",
+                   &reheat_param[REHEAT_P_SLOPE], &reheat_param[REHEAT_P_DUTY],
+                   &reheat_param[REHEAT_P_BOOST],
+                   &reheat_param[REHEAT_P_DECAY]) != REHEAT_PARAMS) {
+          goto usage;
+        }
+        break;
+      case 's':
+        seed = strtoull(optarg, NULL, 0);
+        break;
+      case 'o':
+        out = optarg;
+        break;
+      case 'v':
+        verbose = 1;
+        break;
+      default:
+        goto usage;
+    }
+  }
+  if (optind != argc || (strcmp(mode, "open") && strcmp(mode, "p"))) {
+    goto usage;
+  }
+
+  plant_defaults(&params);
+  params.heater_ohm = HEATER_MOHM / 1000.0;
+  plant_init(&plant, &params, seed);
+  for (i = 0; i < 1024; i++) temp_of[i] = sensor_lookup(i);
+
+  pwr_idx = 0;
+  meterInit();
+  sensorInit();
+
+  script = load(w);
+  if (!script) return 1;
+  host_control = strcmp(mode, "p") == 0;
+
+  gettimeofday(&t0, NULL);
+  run(0.2);  // measure the supply
+  if (workload(script) < 0) return 1;
+  gettimeofday(&t1, NULL);
+  wall = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) * 1e-6;
+
+  if (out && !(f = fopen(out, "w"))) {
+    perror(out);
+    return 1;
+  }
+  fprintf(f, "setpoint_c %.1f\n", setpoint);
+  fprintf(f, "time_to_setpoint_s %.2f\n",
+          reached_time < 0 ? -1 : reached_time - start_time);
+  fprintf(f, "overshoot_c %.1f\n", overshoot);
+  if (recovering) joint_done(0);
+  fprintf(f, "joints %d\n", joints);
+  fprintf(f, "joints_recovered %d\n", recovered);
+  if (finished) {
+    fprintf(f, "droop_mean_c %.1f\n", droop_sum / finished);
+    fprintf(f, "droop_max_c %.1f\n", droop_max);
+    fprintf(f, "energy_per_joint_j %.1f\n", energy_sum / finished);
+  }
+  if (recovered) {
+    fprintf(f, "recovery_mean_s %.2f\n", recovery_sum / recovered);
+    fprintf(f, "recovery_max_s %.2f\n", recovery_max);
+  }
+  fprintf(f, "joints_detected %d\n", detected);
+  fprintf(f, "false_detections %d\n", false_detections);
+  if (detected) {
+    fprintf(f, "detect_latency_mean_ms %.0f\n", latency_sum / detected * 1e3);
+    fprintf(f, "detect_latency_max_ms %.0f\n", latency_max * 1e3);
+  }
+  fprintf(f, "reheat_droop_max_c %.1f\n", reheat_get()->droop_max / 10.0);
+  fprintf(f, "energy_j %.1f\n", plant.energy);
+  fprintf(f, "metered_energy_j %lu\n", (unsigned long)meter_get()->energy);
+  fprintf(f, "simulated_s %.0f\n", plant.time);
+  fprintf(f, "speedup %.0f\n", wall > 0 ? plant.time / wall : 0);
+  if (f != stdout) fclose(f);
+  free(script);
+  return 0;
+
+usage:
+  fprintf(stderr,
+          "usage: %s [-w workload] [-c open|p] [-k gain] "
+          "[-b slope,duty,boost,decay] [-s seed] [-o results] [-v]\n",
+          argv[0]);
+  return 1;
+}
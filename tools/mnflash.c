@@ -0,0 +1,596 @@
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * Update the firmware of many irons through micronucleus, skipping the ones
+ * that already run it.
+ *
+ *   mnflash [-j jobs] firmware.hex tty...
+ *   mnflash [-j jobs] -S installed.hex [-S installed.hex...] firmware.hex
+ *
+ * The CRC-16 of every 64 byte page below the bootloader is read from the
+ * running firmware with 'H' and compared with the image. Irons with
+ * differing pages are rebooted into the bootloader ('b0 r') and flashed,
+ * all irons in parallel (at most 'jobs' at a time). An iron that doesn't
+ * answer 'H' is assumed to be in the bootloader already and flashed.
+ *
+ * micronucleus has no read command and can only erase the whole
+ * application, so a changed iron can't be patched page by page: after the
+ * erase every page of the image that isn't blank is written. The saving
+ * comes from the irons that are skipped and from flashing in parallel.
+ *
+ * With -S the irons are simulated: each one starts out with the given image
+ * installed ('-' for an empty flash) and the USB timing is modelled after
+ * the low-speed control transfers micronucleus uses. The flash contents are
+ * verified after the update.
+ *
+ * For every iron the time taken and the time of a full 'make load' (enter
+ * the bootloader, erase, write the whole image) are reported.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_LIBUSB
+#include <libusb.h>
+#endif
+
+#include "serial.h"
+
+#ifndef BOOTLOADER_ADDRESS
+#define BOOTLOADER_ADDRESS 0x1980
+#endif
+#define PAGE 64
+#define APP_PAGES (BOOTLOADER_ADDRESS / PAGE)
+#define FLASH_SIZE 8192
+#define MAX_IRONS 64
+#define PAGE_LINE 8  // CDC_PAGE_LINE in src/cdc.h
+
+#define MN_VID 0x16D0
+#define MN_PID 0x0753
+#define MN_CMD_INFO 0
+#define MN_CMD_TRANSFER 1
+#define MN_CMD_ERASE 2
+#define MN_CMD_WRITE 3
+#define MN_CMD_RUN 4
+#define MN_WRITE_SLEEP_MS 5  // MICRONUCLEUS_WRITE_SLEEP
+#define MN_WAIT_MS 10000     // for the bootloader to enumerate
+
+// Simulation timing.
+#define SIM_CMD_US 3000     // CDC command round trip, see 'make bench'
+#define SIM_XFER_US 2000    // low-speed control transfer without data
+#define SIM_ENTER_MS 800    // watchdog reset and bootloader enumeration
+#define SIM_RUN_MS 20       // leave the bootloader
+
+typedef struct {
+  uint8_t flash[FLASH_SIZE];
+  int app;   // firmware running, answers 'H'
+  int boot;  // in the bootloader
+  uint64_t now_us;
+  uint16_t addr;  // micronucleus page buffer address
+  int fill;
+  int errors;
+} sim_t;
+
+typedef struct {
+  const char *name;
+  int fd;
+  sim_t *sim;
+#ifdef HAVE_LIBUSB
+  libusb_device_handle *usb;
+#endif
+  char port[32];  // USB port path, e.g. '1-1.2'
+  uint64_t start_us;
+  int differ;  // pages that differ, -1 if unknown
+  int written;
+  int failed;
+  double ms;
+} iron_t;
+
+static uint8_t image[FLASH_SIZE];
+static int image_pages;  // pages up to the end of the image
+static iron_t irons[MAX_IRONS];
+static int n_irons, next_iron;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint16_t crc16(uint16_t crc, uint8_t a) {  // _crc16_update()
+  int i;
+
+  crc ^= a;
+  for (i = 0; i < 8; i++) crc = crc & 1 ? (crc >> 1) ^ 0xA001 : crc >> 1;
+  return crc;
+}
+
+// Same as page_crc() in src/cdc.c.
+static uint16_t page_crc(const uint8_t *flash, int page) {
+  int addr = page * PAGE, end = addr + PAGE;
+  uint16_t crc = 0xFFFF;
+
+  if (page == 0) addr = 2;
+  if (end == BOOTLOADER_ADDRESS) end -= 4;
+  for (; addr < end; addr++) crc = crc16(crc, flash[addr]);
+  return crc;
+}
+
+static int blank(const uint8_t *flash, int page) {
+  int i;
+
+  for (i = 0; i < PAGE; i++) {
+    if (flash[page * PAGE + i] != 0xFF) return 0;
+  }
+  return 1;
+}
+
+// Read an Intel hex file into 'flash'. Returns the end address or -1.
+static int load_hex(const char *path, uint8_t *flash) {
+  char line[600];
+  unsigned len, addr, type, b, i, sum;
+  int end = 0;
+  FILE *f;
+
+  memset(flash, 0xFF, FLASH_SIZE);
+  if (strcmp(path, "-") == 0) return 0;
+  if (!(f = fopen(path, "r"))) {
+    perror(path);
+    return -1;
+  }
+  while (fgets(line, sizeof(line), f)) {
+    if (line[0] != ':' ||
+        sscanf(line + 1, "%2x%4x%2x", &len, &addr, &type) != 3) {
+      continue;
+    }
+    if (type == 1) break;
+    if (type != 0) continue;
+    sum = len + (addr >> 8) + (addr & 0xFF) + type;
+    for (i = 0; i <= len; i++) {
+      if (sscanf(line + 9 + 2 * i, "%2x", &b) != 1) break;
+      sum += b;
+      if (i == len) break;
+      if (addr + i >= BOOTLOADER_ADDRESS) {
+        fprintf(stderr, "%s: data above the bootloader address\n", path);
+        fclose(f);
+        return -1;
+      }
+      flash[addr + i] = b;
+    }
+    if (i != len || (sum & 0xFF)) {
+      fprintf(stderr, "%s: bad record: %s", path, line);
+      fclose(f);
+      return -1;
+    }
+    if ((int)(addr + len) > end) end = addr + len;
+  }
+  fclose(f);
+  return end;
+}
+
+// Move the reset vector into the tiny table in the last page, as the
+// micronucleus v2 command line tool does. The bootloader patches the reset
+// vector itself when page 0 is written.
+static void tiny_table(uint8_t *page, const uint8_t *flash) {
+  int table = (BOOTLOADER_ADDRESS - 4) / 2;  // word address
+  int op = flash[0] | flash[1] << 8, target = 0;
+  unsigned rjmp;
+
+  if ((op & 0xF000) == 0xC000) {  // rjmp, sign extend the 12 bit offset
+    target = ((op & 0xFFF) ^ 0x800) - 0x800 + 1;
+  }
+  rjmp = 0xC000 | ((target - table - 1) & 0xFFF);
+  page[PAGE - 4] = rjmp & 0xFF;
+  page[PAGE - 3] = rjmp >> 8;
+  page[PAGE - 2] = 0xFF;
+  page[PAGE - 1] = 0xFF;
+}
+
+// The reset vector as patched by the bootloader: rjmp to its start.
+static void boot_vector(uint8_t *flash) {
+  unsigned rjmp = 0xC000 | (BOOTLOADER_ADDRESS / 2 - 1);
+
+  flash[0] = rjmp & 0xFF;
+  flash[1] = rjmp >> 8;
+}
+
+/*
+ * Simulated iron.
+ */
+
+static void sim_install(sim_t *sim, const uint8_t *flash) {
+  memcpy(sim->flash, flash, FLASH_SIZE);
+  sim->app = !blank(flash, 0);
+  if (sim->app) {
+    tiny_table(sim->flash + BOOTLOADER_ADDRESS - PAGE, flash);
+    boot_vector(sim->flash);
+  }
+  sim->boot = !sim->app;
+}
+
+// One micronucleus control transfer.
+static int sim_control(sim_t *sim, int cmd, unsigned value, unsigned index,
+                       uint8_t *data) {
+  sim->now_us += SIM_XFER_US;
+  if (!sim->boot) return -1;
+
+  switch (cmd) {
+    case MN_CMD_INFO:
+      data[0] = BOOTLOADER_ADDRESS >> 8;
+      data[1] = BOOTLOADER_ADDRESS & 0xFF;
+      data[2] = PAGE;
+      data[3] = MN_WRITE_SLEEP_MS;
+      data[4] = 0x93;  // ATtiny85
+      data[5] = 0x0B;
+      sim->now_us += SIM_XFER_US;  // data stage
+      return 6;
+    case MN_CMD_ERASE:
+      memset(sim->flash, 0xFF, BOOTLOADER_ADDRESS);
+      sim->now_us += APP_PAGES * MN_WRITE_SLEEP_MS * 1000;
+      return 0;
+    case MN_CMD_TRANSFER:
+      if (value != PAGE || index % PAGE || index >= BOOTLOADER_ADDRESS) {
+        return -1;
+      }
+      sim->addr = index;
+      sim->fill = 0;
+      return 0;
+    case MN_CMD_WRITE: {
+      uint8_t b[4] = {value & 0xFF, value >> 8, index & 0xFF, index >> 8};
+      int i;
+
+      for (i = 0; i < 4; i++, sim->fill++) {
+        int a = sim->addr + sim->fill;
+
+        if (a == 0) boot_vector(b);
+        // Flash can only be programmed from 1 to 0 without an erase.
+        if (sim->flash[a] != 0xFF && sim->flash[a] != b[i]) sim->errors++;
+        sim->flash[a] &= b[i];
+      }
+      if (sim->fill == PAGE) sim->now_us += MN_WRITE_SLEEP_MS * 1000;
+      return 0;
+    }
+    case MN_CMD_RUN:
+      sim->boot = 0;
+      sim->app = 1;
+      sim->now_us += SIM_RUN_MS * 1000;
+      return 0;
+  }
+  return -1;
+}
+
+/*
+ * Iron access, simulated or real.
+ */
+
+static uint64_t iron_now_us(iron_t *iron) {
+  return iron->sim ? iron->sim->now_us : serial_now_us();
+}
+
+// Read the page checksums from the running firmware.
+static int iron_pages(iron_t *iron, uint16_t *crc) {
+  char cmd[16], reply[128];
+  unsigned pages, size, v[PAGE_LINE];
+  int i, j, n;
+
+  if (iron->sim) {
+    iron->sim->now_us += SIM_CMD_US * (1 + (APP_PAGES + 7) / PAGE_LINE);
+    if (!iron->sim->app) return -1;
+    for (i = 0; i < APP_PAGES; i++) crc[i] = page_crc(iron->sim->flash, i);
+    return 0;
+  }
+
+  if (serial_cmd(iron->fd, "h", reply, sizeof(reply), 1, 0) != 1 ||
+      sscanf(reply, "%2x %2x", &pages, &size) != 2 || pages != APP_PAGES ||
+      size != PAGE) {
+    return -1;
+  }
+  for (i = 0; i < APP_PAGES; i += PAGE_LINE) {
+    snprintf(cmd, sizeof(cmd), "%02x h", i);
+    if (serial_cmd(iron->fd, cmd, reply, sizeof(reply), 1, 0) != 1) return -1;
+    n = sscanf(reply, "%4x %4x %4x %4x %4x %4x %4x %4x", &v[0], &v[1], &v[2],
+               &v[3], &v[4], &v[5], &v[6], &v[7]);
+    if (n != (APP_PAGES - i < PAGE_LINE ? APP_PAGES - i : PAGE_LINE)) {
+      return -1;
+    }
+    for (j = 0; j < n; j++) crc[i + j] = v[j];
+  }
+  return 0;
+}
+
+#ifdef HAVE_LIBUSB
+// USB port path of a tty, '1-1.2' for /sys/devices/.../1-1.2/1-1.2:1.0.
+static int tty_port(const char *tty, char *port, size_t len) {
+  char path[PATH_MAX], real[PATH_MAX], *p;
+  const char *name = strrchr(tty, '/');
+
+  snprintf(path, sizeof(path), "/sys/class/tty/%s/device",
+           name ? name + 1 : tty);
+  if (!realpath(path, real) || !(p = strrchr(real, '/'))) return -1;
+  snprintf(port, len, "%s", p + 1);
+  if ((p = strchr(port, ':'))) *p = '\0';
+  return 0;
+}
+
+static libusb_device_handle *usb_find(const char *port) {
+  libusb_device **list;
+  libusb_device_handle *h = NULL;
+  ssize_t i, n = libusb_get_device_list(NULL, &list);
+
+  for (i = 0; i < n && !h; i++) {
+    struct libusb_device_descriptor d;
+    uint8_t ports[8];
+    char path[32];
+    int k, np, len;
+
+    if (libusb_get_device_descriptor(list[i], &d) || d.idVendor != MN_VID ||
+        d.idProduct != MN_PID) {
+      continue;
+    }
+    np = libusb_get_port_numbers(list[i], ports, sizeof(ports));
+    len = snprintf(path, sizeof(path), "%d",
+                   libusb_get_bus_number(list[i]));
+    for (k = 0; k < np && len < (int)sizeof(path); k++) {
+      len += snprintf(path + len, sizeof(path) - len, "%c%d", k ? '.' : '-',
+                      ports[k]);
+    }
+    if (strcmp(path, port) == 0 && libusb_open(list[i], &h)) h = NULL;
+  }
+  libusb_free_device_list(list, 1);
+  return h;
+}
+#endif
+
+static int iron_control(iron_t *iron, int cmd, unsigned value, unsigned index,
+                        uint8_t *data) {
+  if (iron->sim) return sim_control(iron->sim, cmd, value, index, data);
+#ifdef HAVE_LIBUSB
+  {
+    int r = libusb_control_transfer(
+        iron->usb,
+        LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE |
+            (data ? LIBUSB_ENDPOINT_IN : LIBUSB_ENDPOINT_OUT),
+        cmd, value, index, data, data ? 6 : 0, 1000);
+
+    if (cmd == MN_CMD_ERASE) {
+      // The bootloader stops answering while it erases.
+      usleep(APP_PAGES * MN_WRITE_SLEEP_MS * 1000);
+      return 0;
+    }
+    return r < 0 && cmd != MN_CMD_RUN ? -1 : r;
+  }
+#else
+  return -1;
+#endif
+}
+
+// Reboot into the bootloader and wait for it.
+static int iron_enter(iron_t *iron) {
+  if (iron->sim) {
+    iron->sim->now_us += SIM_ENTER_MS * 1000;
+    iron->sim->app = 0;
+    iron->sim->boot = 1;
+    return 0;
+  }
+#ifdef HAVE_LIBUSB
+  {
+    uint64_t deadline = serial_now_us() + MN_WAIT_MS * 1000ULL;
+
+    if (iron->fd >= 0) {
+      if (write(iron->fd, "b0 r\r", 5) != 5) return -1;
+      close(iron->fd);
+      iron->fd = -1;
+    }
+    while (!(iron->usb = usb_find(iron->port))) {
+      if (serial_now_us() > deadline) return -1;
+      usleep(50000);
+    }
+    return 0;
+  }
+#else
+  fprintf(stderr, "%s: built without libusb\n", iron->name);
+  return -1;
+#endif
+}
+
+static int iron_write_page(iron_t *iron, int page, const uint8_t *data) {
+  int i;
+
+  if (iron_control(iron, MN_CMD_TRANSFER, PAGE, page * PAGE, NULL)) return -1;
+  for (i = 0; i < PAGE; i += 4) {
+    if (iron_control(iron, MN_CMD_WRITE, data[i] | data[i + 1] << 8,
+                     data[i + 2] | data[i + 3] << 8, NULL)) {
+      return -1;
+    }
+  }
+  if (!iron->sim) usleep(MN_WRITE_SLEEP_MS * 1000);
+  return 0;
+}
+
+static void iron_close(iron_t *iron) {
+  if (iron->fd >= 0) close(iron->fd);
+  iron->fd = -1;
+#ifdef HAVE_LIBUSB
+  if (iron->usb) libusb_close(iron->usb);
+  iron->usb = NULL;
+#endif
+}
+
+static int flash_iron(iron_t *iron) {
+  uint16_t crc[APP_PAGES];
+  uint8_t info[6], last[PAGE];
+  int i;
+
+  iron->differ = -1;
+  if (iron_pages(iron, crc) == 0) {
+    iron->differ = 0;
+    for (i = 0; i < APP_PAGES; i++) {
+      if (crc[i] != page_crc(image, i)) iron->differ++;
+    }
+    if (iron->differ == 0) return 0;
+  }
+
+  if (iron_enter(iron) || iron_control(iron, MN_CMD_INFO, 0, 0, info) != 6) {
+    return -1;
+  }
+  if ((info[0] << 8 | info[1]) != BOOTLOADER_ADDRESS || info[2] != PAGE) {
+    fprintf(stderr, "%s: bootloader at %04X, page size %d\n", iron->name,
+            info[0] << 8 | info[1], info[2]);
+    return -1;
+  }
+  if (iron_control(iron, MN_CMD_ERASE, 0, 0, NULL)) return -1;
+
+  // Page 0 holds the reset vector, the last page the tiny table.
+  for (i = 0; i < APP_PAGES - 1; i++) {
+    if (i && blank(image, i)) continue;
+    if (iron_write_page(iron, i, image + i * PAGE)) return -1;
+    iron->written++;
+  }
+  memcpy(last, image + (APP_PAGES - 1) * PAGE, PAGE);
+  tiny_table(last, image);
+  if (iron_write_page(iron, APP_PAGES - 1, last)) return -1;
+  iron->written++;
+
+  return iron_control(iron, MN_CMD_RUN, 0, 0, NULL);
+}
+
+// Time of 'make load': enter the bootloader, erase, write all pages of the
+// image and the tiny table page.
+static double full_ms(void) {
+  double page_us = (1 + PAGE / 4) * SIM_XFER_US + MN_WRITE_SLEEP_MS * 1000;
+  int pages = image_pages < APP_PAGES ? image_pages + 1 : APP_PAGES;
+
+  return SIM_ENTER_MS + 2 * SIM_XFER_US / 1000.0 +
+         APP_PAGES * MN_WRITE_SLEEP_MS + pages * page_us / 1000 + SIM_RUN_MS;
+}
+
+static void *worker(void *arg) {
+  iron_t *iron;
+
+  (void)arg;
+  for (;;) {
+    pthread_mutex_lock(&lock);
+    iron = next_iron < n_irons ? &irons[next_iron++] : NULL;
+    pthread_mutex_unlock(&lock);
+    if (!iron) return NULL;
+
+    iron->start_us = iron_now_us(iron);
+    iron->failed = flash_iron(iron) != 0;
+    iron->ms = (iron_now_us(iron) - iron->start_us) / 1000.0;
+    iron_close(iron);
+  }
+}
+
+int main(int argc, char **argv) {
+  static sim_t sims[MAX_IRONS];
+  static uint8_t installed[FLASH_SIZE];
+  pthread_t threads[MAX_IRONS];
+  int opt, i, jobs = MAX_IRONS, failed = 0, flashed = 0;
+  double full, wall = 0;
+  uint64_t start;
+
+  while ((opt = getopt(argc, argv, "j:S:")) != -1) {
+    switch (opt) {
+      case 'j':
+        jobs = atoi(optarg);
+        break;
+      case 'S':
+        if (n_irons == MAX_IRONS || load_hex(optarg, installed) < 0) return 1;
+        sim_install(&sims[n_irons], installed);
+        irons[n_irons].name = optarg;
+        irons[n_irons].sim = &sims[n_irons];
+        irons[n_irons++].fd = -1;
+        break;
+      default:
+        optind = argc + 1;
+    }
+  }
+  if (optind >= argc || jobs < 1 ||
+      (n_irons == 0) == (optind + 1 == argc)) {
+    fprintf(stderr,
+            "usage: %s [-j jobs] firmware.hex tty...\n"
+            "       %s [-j jobs] -S installed.hex... firmware.hex\n",
+            argv[0], argv[0]);
+    return 1;
+  }
+  if ((image_pages = load_hex(argv[optind], image)) < 0) return 1;
+  image_pages = (image_pages + PAGE - 1) / PAGE;
+
+#ifdef HAVE_LIBUSB
+  if (n_irons == 0 && libusb_init(NULL)) {
+    fprintf(stderr, "libusb_init failed\n");
+    return 1;
+  }
+#endif
+  for (i = optind + 1; i < argc && n_irons < MAX_IRONS; i++) {
+    iron_t *iron = &irons[n_irons++];
+
+    iron->name = argv[i];
+    iron->fd = serial_open(argv[i]);
+#ifdef HAVE_LIBUSB
+    if (tty_port(argv[i], iron->port, sizeof(iron->port))) {
+      fprintf(stderr, "%s: USB port unknown\n", argv[i]);
+      return 1;
+    }
+#endif
+  }
+
+  if (jobs > n_irons) jobs = n_irons;
+  start = serial_now_us();
+  for (i = 0; i < jobs; i++) pthread_create(&threads[i], NULL, worker, NULL);
+  for (i = 0; i < jobs; i++) pthread_join(threads[i], NULL);
+
+  full = full_ms();
+  for (i = 0; i < n_irons; i++) {
+    iron_t *iron = &irons[i];
+
+    printf("%s: ", iron->name);
+    if (iron->differ < 0) {
+      printf("checksums unavailable, ");
+    } else {
+      printf("%d/%d pages differ, ", iron->differ, APP_PAGES);
+    }
+    if (iron->sim && iron->sim->errors) iron->failed = 1;
+    if (iron->sim && !iron->failed) {
+      uint8_t expect[FLASH_SIZE];
+
+      memcpy(expect, image, FLASH_SIZE);
+      tiny_table(expect + BOOTLOADER_ADDRESS - PAGE, image);
+      boot_vector(expect);
+      if (memcmp(expect, iron->sim->flash, BOOTLOADER_ADDRESS)) {
+        iron->failed = 1;
+      }
+    }
+    printf("%s, %d pages written, %.0f ms, full flash %.0f ms\n",
+           iron->failed ? "FAILED" : iron->written ? "flashed" : "up to date",
+           iron->written, iron->ms, full);
+    failed += iron->failed;
+    flashed += iron->written > 0;
+  }
+
+  // Simulated irons have their own clocks: hand each one to the worker
+  // that is free first and take the time the last worker finishes.
+  if (irons[0].sim) {
+    double busy[MAX_IRONS] = {0};
+    int j, w;
+
+    for (i = 0; i < n_irons; i++) {
+      for (w = 0, j = 1; j < jobs; j++) {
+        if (busy[j] < busy[w]) w = j;
+      }
+      busy[w] += irons[i].ms;
+      if (busy[w] > wall) wall = busy[w];
+    }
+  } else {
+    wall = (serial_now_us() - start) / 1000.0;
+  }
+  printf("%d irons, %d flashed, %d failed: %.0f ms, sequential full flash "
+         "%.0f ms, saved %.0f ms\n",
+         n_irons, flashed, failed, wall, full * n_irons,
+         full * n_irons - wall);
+  return failed != 0;
+}
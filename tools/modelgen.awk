@@ -0,0 +1,56 @@
+# Authors: tickelton@gmail.com
+# Licenses: GNU GPL version 2. See License.txt.
+# Copyright: (c) 2021 tickelton@gmail.com
+#
+# Generate src/model.h from the model descriptor in the Makefile:
+#
+#   awk -v model=stock -v mohm=3100 -v pwm_hz=1 -v budget=480 \
+#     -v presets="230:50 260:58 290:66" -f modelgen.awk > model.h
+#
+# mohm is the heater resistance, pwm_hz the PWM frequency (1, 2, 4 or 8;
+# the period is 256 TIMER0 overflows at 1 Hz and halves with each step),
+# budget the heater current in mA and presets the temperatures in degrees
+# C, each with the duty cycle used until the iron is calibrated. A duty
+# cycle above the current limit at 5V (budget * mohm * 256 / 5000000, as
+# heater_calibrate() computes it) would be cut to the limit, so it fails.
+
+function fail(msg) {
+  print "modelgen: " model ": " msg > "/dev/stderr"
+  exit 1
+}
+
+BEGIN {
+  if (mohm !~ /^[0-9]+$/ || mohm < 100) fail("bad heater resistance")
+  if (budget !~ /^[0-9]+$/ || budget < 1) fail("bad current budget")
+  for (shift = 0; shift < 4 && 2 ^ shift != pwm_hz; shift++) {
+  }
+  if (shift == 4) fail("PWM frequency must be 1, 2, 4 or 8 Hz")
+
+  limit = int(budget * mohm * 256 / 5000000)
+  n = split(presets, p, " ")
+  if (n < 1 || n > 6) fail("1 to 6 presets")
+  steps = "0"
+  temps = ""
+  for (i = 1; i <= n; i++) {
+    if (split(p[i], f, ":") != 2 || f[1] !~ /^[0-9]+$/ ||
+        f[2] !~ /^[0-9]+$/ || f[1] < 2 || f[1] > 510 || f[2] > 255)
+      fail("bad preset " p[i])
+    if (f[2] > limit)
+      fail("preset " p[i] " above the current limit, duty " limit)
+    steps = steps ", " f[2]
+    temps = temps (i > 1 ? ", " : "") int(f[1] / 2)
+  }
+
+  print "// Generated by tools/modelgen.awk for MODEL=" model ", do not edit."
+  print "#ifndef __MODEL_H__"
+  print "#define __MODEL_H__"
+  print ""
+  print "#define HEATER_MOHM " mohm "L"
+  print "#define HEATER_BUDGET_MA " budget
+  print "#define HEATER_PWM_SHIFT " shift "  // " pwm_hz " Hz"
+  print "#define MODEL_PRESETS " n
+  print "#define MODEL_PWR_STEPS {" steps "}"
+  print "#define CAL_PRESETS {" temps "}"
+  print ""
+  print "#endif  // __MODEL_H__"
+}
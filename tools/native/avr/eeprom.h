@@ -0,0 +1,21 @@
+#ifndef __NATIVE_AVR_EEPROM_H__
+#define __NATIVE_AVR_EEPROM_H__
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * See tools/native/avr/io.h. EEMEM variables live in RAM and start out
+ * zeroed, writes complete immediately.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#define EEMEM
+#define eeprom_is_ready() 1
+#define eeprom_read_byte(p) (*(const uint8_t *)(p))
+#define eeprom_write_byte(p, v) (*(uint8_t *)(p) = (v))
+#define eeprom_read_block(dst, src, n) memcpy((dst), (src), (n))
+
+#endif  // __NATIVE_AVR_EEPROM_H__
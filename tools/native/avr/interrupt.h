@@ -0,0 +1,16 @@
+#ifndef __NATIVE_AVR_INTERRUPT_H__
+#define __NATIVE_AVR_INTERRUPT_H__
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * See tools/native/avr/io.h. The simulator is single threaded.
+ */
+
+#include <avr/io.h>
+
+#define cli()
+#define sei()
+
+#endif  // __NATIVE_AVR_INTERRUPT_H__
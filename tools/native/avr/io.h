@@ -0,0 +1,27 @@
+#ifndef __NATIVE_AVR_IO_H__
+#define __NATIVE_AVR_IO_H__
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * Host build of the firmware control code (tools/ironsim.c).
+ *
+ * The headers in tools/native stand in for avr-libc. Only what heater.c,
+ * standby.c, sensor.c, meter.c and nvm.c use is provided; the I/O
+ * registers are plain variables defined and driven by the simulator.
+ */
+
+#include <stdint.h>
+
+extern volatile uint8_t ADMUX, ADCSRA, DIDR0;
+extern volatile uint16_t ADC;
+
+#define ADC0D 5
+#define ADEN 7
+#define ADSC 6
+#define ADPS2 2
+#define ADPS1 1
+#define ADPS0 0
+
+#endif  // __NATIVE_AVR_IO_H__
@@ -0,0 +1,18 @@
+#ifndef __NATIVE_AVR_PGMSPACE_H__
+#define __NATIVE_AVR_PGMSPACE_H__
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * See tools/native/avr/io.h. Flash is ordinary memory on the host.
+ */
+
+#include <stdint.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+
+#endif  // __NATIVE_AVR_PGMSPACE_H__
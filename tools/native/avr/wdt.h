@@ -0,0 +1,15 @@
+#ifndef __NATIVE_AVR_WDT_H__
+#define __NATIVE_AVR_WDT_H__
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * See tools/native/avr/io.h.
+ */
+
+#define wdt_reset()
+#define wdt_enable(t)
+#define wdt_disable()
+
+#endif  // __NATIVE_AVR_WDT_H__
@@ -0,0 +1,13 @@
+#ifndef __NATIVE_USBDRV_H__
+#define __NATIVE_USBDRV_H__
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * See tools/native/avr/io.h. Only the types cdc.h needs, no USB.
+ */
+
+typedef unsigned char uchar;
+
+#endif  // __NATIVE_USBDRV_H__
@@ -0,0 +1,13 @@
+#ifndef __NATIVE_UTIL_DELAY_H__
+#define __NATIVE_UTIL_DELAY_H__
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * See tools/native/avr/io.h.
+ */
+
+#define _delay_ms(ms)
+
+#endif  // __NATIVE_UTIL_DELAY_H__
@@ -0,0 +1,210 @@
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * Assign staggered PWM phase offsets to irons sharing one supply.
+ *
+ * Each iron switches its heater on at the start of its PWM period and off
+ * after 'duty' of 256 steps. Placing the on-times of all irons back to back
+ * (mod 256) keeps the number of heaters that are on at the same time at
+ * ceil(sum(duty) / 256), the lowest possible peak.
+ *
+ * The duty cycle packed is the effective one the iron reports with 'v',
+ * after supply compensation and the current limit. Irons of models with a
+ * different PWM frequency can't be staggered against each other.
+ *
+ * The RC oscillators of the irons drift against each other by up to a few
+ * percent, so the offsets are refreshed periodically.
+ *
+ *   phasecoord [-i seconds] tty...     coordinate the given irons
+ *   phasecoord -s [-r ohm] [-v volt] duty...
+ *                                      simulate the supply current
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "serial.h"
+
+#define MAX_IRONS 64
+#define PWM_STEPS 256
+#define F_CPU 16500000.0
+#define STEP_US (65536.0 / F_CPU * 1e6)  // one TIMER0 overflow
+#define SIM_TRIALS 1000
+
+// Start of each iron's on-time when packed back to back.
+static void pack(const int *duty, int n, int *slot) {
+  int i, pos = 0;
+
+  for (i = 0; i < n; i++) {
+    slot[i] = pos;
+    pos = (pos + duty[i]) % PWM_STEPS;
+  }
+}
+
+// Peak supply current in units of one heater for the given start slots.
+static int peak(const int *duty, const int *slot, int n) {
+  int k, i, on, max = 0;
+
+  for (k = 0; k < PWM_STEPS; k++) {
+    on = 0;
+    for (i = 0; i < n; i++) {
+      if ((k - slot[i] + PWM_STEPS) % PWM_STEPS < duty[i]) on++;
+    }
+    if (on > max) max = on;
+  }
+  return max;
+}
+
+static int simulate(int argc, char **argv, double ohm, double volt) {
+  int duty[MAX_IRONS], slot[MAX_IRONS];
+  int i, t, n = 0, sum = 0;
+  double amp = volt / ohm, avg, rnd = 0;
+  int aligned, staggered, worst = 0;
+
+  for (i = 0; i < argc && n < MAX_IRONS; i++) {
+    duty[n] = (int)strtol(argv[i], NULL, 0);
+    if (duty[n] < 0 || duty[n] >= PWM_STEPS) {
+      fprintf(stderr, "duty out of range: %s\n", argv[i]);
+      return 1;
+    }
+    sum += duty[n++];
+  }
+  if (n == 0) return 1;
+
+  avg = amp * sum / PWM_STEPS;
+
+  memset(slot, 0, sizeof(slot));
+  aligned = peak(duty, slot, n);
+
+  srand(1);
+  for (t = 0; t < SIM_TRIALS; t++) {
+    int p;
+
+    for (i = 0; i < n; i++) slot[i] = rand() % PWM_STEPS;
+    p = peak(duty, slot, n);
+    rnd += p;
+    if (p > worst) worst = p;
+  }
+  rnd /= SIM_TRIALS;
+
+  pack(duty, n, slot);
+  staggered = peak(duty, slot, n);
+
+  printf("irons:      %d, %.2f A per heater\n", n, amp);
+  printf("average:    %.2f A\n", avg);
+  printf("aligned:    peak %.2f A (%.2f x average)\n", aligned * amp,
+         aligned * amp / avg);
+  printf("random:     peak %.2f A mean, %.2f A worst (%d trials)\n",
+         rnd * amp, worst * amp, SIM_TRIALS);
+  printf("staggered:  peak %.2f A (%.2f x average)\n", staggered * amp,
+         staggered * amp / avg);
+  for (i = 0; i < n; i++) {
+    printf("  iron %d: duty %3d offset %3d\n", i, duty[i], slot[i]);
+  }
+  return 0;
+}
+
+static int coordinate(int argc, char **argv, int interval) {
+  int fd[MAX_IRONS], duty[MAX_IRONS], slot[MAX_IRONS], step[MAX_IRONS];
+  int inc[MAX_IRONS];  // steps per TIMER0 overflow
+  uint64_t when[MAX_IRONS];
+  char reply[64], cmd[16];
+  int i, n = argc < MAX_IRONS ? argc : MAX_IRONS;
+
+  for (i = 0; i < n; i++) {
+    fd[i] = serial_open(argv[i]);
+    if (fd[i] < 0) {
+      perror(argv[i]);
+      return 1;
+    }
+  }
+
+  for (;;) {
+    for (i = 0; i < n; i++) {
+      unsigned phase, s, k, mv, factor, d;
+      uint64_t t0;
+
+      if (serial_cmd(fd[i], "v", reply, sizeof(reply), 1, 0) != 1 ||
+          sscanf(reply, "%x %x %x", &mv, &factor, &d) != 3) {
+        goto err;
+      }
+      duty[i] = d;
+      t0 = serial_now_us();
+      if (serial_cmd(fd[i], "p", reply, sizeof(reply), 1, 0) != 1 ||
+          sscanf(reply, "%x %x %x", &phase, &s, &k) != 3) {
+        goto err;
+      }
+      // The step was sampled somewhere within the round trip.
+      when[i] = (t0 + serial_now_us()) / 2;
+      step[i] = s;
+      inc[i] = k;
+      if (inc[i] != inc[0]) {
+        fprintf(stderr, "%s: PWM frequency differs from %s\n", argv[i],
+                argv[0]);
+        return 1;
+      }
+    }
+
+    pack(duty, n, slot);
+    for (i = 0; i < n; i++) {
+      // Position of iron i at the time iron 0 was sampled, plus the slot:
+      // that's when its period has to start. The position advances by
+      // inc steps per TIMER0 overflow.
+      double d = ((double)when[0] - (double)when[i]) / STEP_US;
+      int phase =
+          (step[i] + (int)lround(d * inc[i]) + slot[i]) & (PWM_STEPS - 1);
+
+      snprintf(cmd, sizeof(cmd), "%02X p", phase);
+      serial_cmd(fd[i], cmd, reply, sizeof(reply), 0, 50);
+      printf("%s: duty %3d offset %3d\n", argv[i], duty[i], slot[i]);
+    }
+    fflush(stdout);
+
+    if (interval == 0) return 0;
+    sleep(interval);
+  }
+
+err:
+  fprintf(stderr, "%s: no response\n", argv[i]);
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  int opt, sim = 0, interval = 10;
+  double ohm = 3.1, volt = 5.0;
+
+  while ((opt = getopt(argc, argv, "si:r:v:")) != -1) {
+    switch (opt) {
+      case 's':
+        sim = 1;
+        break;
+      case 'i':
+        interval = atoi(optarg);
+        break;
+      case 'r':
+        ohm = atof(optarg);
+        break;
+      case 'v':
+        volt = atof(optarg);
+        break;
+      default:
+        goto usage;
+    }
+  }
+  if (optind >= argc) goto usage;
+
+  if (sim) return simulate(argc - optind, argv + optind, ohm, volt);
+  return coordinate(argc - optind, argv + optind, interval);
+
+usage:
+  fprintf(stderr,
+          "usage: %s [-i seconds] tty...\n"
+          "       %s -s [-r ohm] [-v volt] duty...\n",
+          argv[0], argv[0]);
+  return 1;
+}
@@ -0,0 +1,91 @@
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ */
+
+#include "plant.h"
+
+#include <math.h>
+
+#define PLANT_DT 0.001  // largest integration step, well below all time
+                        // constants of the default parameters
+
+void plant_defaults(plant_params_t *p) {
+  p->heater_ohm = 3.1;
+  p->vcc = 5.1;
+  p->source_ohm = 0.15;
+  // The current budget allows ~2.3W (duty 4C), which holds the core at
+  // ~320 C; time constant ~1 minute.
+  p->core_c = 0.25;
+  p->tip_c = 0.2;
+  p->core_tip_g = 0.12;
+  p->loss_g = 0.0079;
+  p->joint_c = 0.05;
+  p->joint_g = 0.03;
+  p->ambient = 25;
+  p->sensor_tau = 0.3;
+  p->sensor_noise = 0.5;
+}
+
+void plant_init(plant_t *s, const plant_params_t *p, uint64_t seed) {
+  s->p = *p;
+  s->core = s->tip = s->joint = s->sensor = p->ambient;
+  s->energy = 0;
+  s->time = 0;
+  s->loaded = 0;
+  s->rng = seed ? seed : 1;
+}
+
+double plant_vcc(const plant_t *s, int on) {
+  const plant_params_t *p = &s->p;
+
+  return on ? p->vcc * p->heater_ohm / (p->heater_ohm + p->source_ohm)
+            : p->vcc;
+}
+
+void plant_load(plant_t *s, int loaded) {
+  if (loaded && !s->loaded) s->joint = s->p.ambient;
+  s->loaded = loaded;
+}
+
+void plant_step(plant_t *s, int on, double dt) {
+  const plant_params_t *p = &s->p;
+  double v = plant_vcc(s, on), w = on ? v * v / p->heater_ohm : 0;
+
+  while (dt > 0) {
+    double h = dt < PLANT_DT ? dt : PLANT_DT;
+    double q_ct = (s->core - s->tip) * p->core_tip_g;
+    double q_loss = (s->tip - p->ambient) * p->loss_g;
+    double q_joint = s->loaded ? (s->tip - s->joint) * p->joint_g : 0;
+
+    s->core += (w - q_ct) * h / p->core_c;
+    s->tip += (q_ct - q_loss - q_joint) * h / p->tip_c;
+    s->joint += q_joint * h / p->joint_c;
+    s->sensor += (s->core - s->sensor) * h / p->sensor_tau;
+    s->energy += w * h;
+    s->time += h;
+    dt -= h;
+  }
+}
+
+// xorshift64*, good enough for sensor noise.
+static double plant_uniform(plant_t *s) {
+  s->rng ^= s->rng >> 12;
+  s->rng ^= s->rng << 25;
+  s->rng ^= s->rng >> 27;
+  return ((s->rng * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+double plant_sensor(plant_t *s) {
+  double u1 = plant_uniform(s), u2 = plant_uniform(s);
+
+  if (u1 < 1e-300) u1 = 1e-300;
+  return s->sensor +
+         s->p.sensor_noise * sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+double plant_steady(const plant_params_t *p, double w) {
+  // In steady state the whole power flows through the tip to ambient.
+  return p->ambient + w / p->loss_g + w / p->core_tip_g;
+}
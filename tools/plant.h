@@ -0,0 +1,68 @@
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * Thermal model of the iron for closed-loop simulation.
+ *
+ * Two lumped masses: the heater core, which carries the sensor, and the tip.
+ * The heater dissipates VCC^2 / R while the MOSFET is on; VCC sags with the
+ * heater current through the source resistance of the supply. The tip loses
+ * heat to the holder and the air, and while a joint is loaded, to the joint
+ * which starts at ambient temperature and has a thermal mass of its own.
+ * The sensor follows the core with a first order lag and adds Gaussian
+ * noise.
+ *
+ * All temperatures are in degrees C, energies in J, times in seconds.
+ */
+
+#ifndef __PLANT_H__
+#define __PLANT_H__
+
+#include <stdint.h>
+
+typedef struct {
+  double heater_ohm;    // heater resistance
+  double vcc;           // open circuit supply voltage
+  double source_ohm;    // supply and cable resistance
+  double core_c;        // heat capacity of the heater core, J/K
+  double tip_c;         // heat capacity of the tip, J/K
+  double core_tip_g;    // conductance core to tip, W/K
+  double loss_g;        // tip to ambient (holder, air), W/K
+  double joint_c;       // heat capacity of a joint, J/K
+  double joint_g;       // tip to joint while loaded, W/K
+  double ambient;
+  double sensor_tau;    // s
+  double sensor_noise;  // standard deviation, degrees C
+} plant_params_t;
+
+typedef struct {
+  plant_params_t p;
+  double core, tip, joint, sensor;
+  double energy;  // delivered by the heater
+  double time;
+  int loaded;
+  uint64_t rng;
+} plant_t;
+
+// Parameters of the stock iron.
+void plant_defaults(plant_params_t *p);
+
+void plant_init(plant_t *s, const plant_params_t *p, uint64_t seed);
+
+// Advance by 'dt' with the heater on or off.
+void plant_step(plant_t *s, int on, double dt);
+
+// Put a fresh joint on the tip, or take it off.
+void plant_load(plant_t *s, int loaded);
+
+// Supply voltage at the iron with the heater on or off.
+double plant_vcc(const plant_t *s, int on);
+
+// Sensed temperature including lag and noise.
+double plant_sensor(plant_t *s);
+
+// Steady state core temperature for an average heater power 'w'.
+double plant_steady(const plant_params_t *p, double w);
+
+#endif  // __PLANT_H__
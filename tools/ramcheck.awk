@@ -0,0 +1,179 @@
+# Authors: tickelton@gmail.com
+# Licenses: GNU GPL version 2. See License.txt.
+# Copyright: (c) 2021 tickelton@gmail.com
+#
+# Worst-case RAM usage of the linked firmware against the SRAM budget, and
+# its flash usage against 'flash', the start of the bootloader:
+#
+#   { avr-size -A Soldering.elf; avr-objdump -d Soldering.elf; } | \
+#     awk -v budget=512 -v flash=0x1980 -v icall="usbPoll cdc_poll ..." \
+#     -f ramcheck.awk
+#
+# With -v model=NAME only a line 'NAME flash left ram left' is printed, for
+# the table of 'make variants'.
+#
+# The static part is the .data, .bss and .noinit sections. The stack depth
+# of every function is its frame (pushes and the frame pointer adjustment
+# of the prologue) plus the deepest of its callees, with 2 bytes of return
+# address per call. Indirect calls can reach any function listed in
+# 'icall', the scheduler tasks. Interrupts add their own depth on top of
+# main(); an ISR that re-enables interrupts (ISR_NOBLOCK, starting with
+# 'sei') can in turn be interrupted by the deepest other one.
+#
+# Exits with 1 if either doesn't fit.
+
+BEGIN {
+  FS = "\t"
+  n_icall = split(icall, icall_fn, " ")
+}
+
+function num(s, v, i) {
+  if (s !~ /^0x/) return s + 0
+  s = tolower(substr(s, 3))
+  for (i = 1; i <= length(s); i++)
+    v = v * 16 + index("0123456789abcdef", substr(s, i, 1)) - 1
+  return v
+}
+
+# Size lines of 'avr-size -A'.
+/^\.(text|data|bss|noinit) +[0-9]+ +[0-9]+ *$/ {
+  split($0, sz, " ")
+  if (sz[1] != ".text") static += sz[2]
+  if (sz[1] != ".bss" && sz[1] != ".noinit") text += sz[2]
+  next
+}
+
+/^[0-9a-f]+ <.*>:$/ {
+  cur = $0
+  sub(/^[^<]*</, "", cur)
+  sub(/>:$/, "", cur)
+  frame[cur] = 0
+  prologue = 0
+  next
+}
+
+cur != "" && NF >= 3 {
+  op = $3
+  gsub(/ /, "", op)
+  arg = $4
+  gsub(/ /, "", arg)
+  if (!(cur in first)) first[cur] = op
+
+  if (op == "push") {
+    frame[cur]++
+  } else if (op == "rcall" && arg == ".+0") {
+    frame[cur] += 2  # allocates 2 bytes of frame
+  } else if (op == "in" && arg == "r28,0x3d") {
+    prologue = 1
+  } else if (op == "out" && arg == "0x3d,r28") {
+    prologue = 0
+  } else if (prologue && (op == "sbiw" || op == "subi") &&
+             arg ~ /^r28,/) {
+    frame[cur] += num(substr(arg, 5))
+  } else if (op == "icall") {
+    indirect[cur] = 1
+  } else if (op ~ /^r?(call|jmp)$/ && match($NF, /<[^>]*>$/)) {
+    t = substr($NF, RSTART + 1, RLENGTH - 2)
+    sub(/\+0x[0-9a-f]+$/, "", t)
+    if (t != cur) {
+      if (op ~ /call$/)
+        calls[cur] = calls[cur] " " t
+      else
+        jumps[cur] = jumps[cur] " " t
+    }
+  }
+}
+
+function depth(f, d, best_d, i, k, c, t) {
+  if (state[f] == 2) return deep[f]
+  if (state[f] == 1) {
+    print "ramcheck: recursion through " f " not included" > "/dev/stderr"
+    return 0
+  }
+  state[f] = 1
+  best_d = 0
+  k = split(calls[f], c, " ")
+  for (i = 1; i <= k; i++) {
+    d = 2 + depth(c[i])
+    if (d > best_d) { best_d = d; via[f] = c[i] }
+  }
+  k = split(jumps[f], c, " ")
+  for (i = 1; i <= k; i++) {
+    d = depth(c[i])
+    if (d > best_d) { best_d = d; via[f] = c[i] }
+  }
+  if (indirect[f]) {
+    if (!n_icall) print "ramcheck: icall in " f " without targets" > "/dev/stderr"
+    for (i = 1; i <= n_icall; i++) {
+      t = icall_fn[i]
+      if (!(t in frame)) continue
+      d = 2 + depth(t)
+      if (d > best_d) { best_d = d; via[f] = t }
+    }
+  }
+  state[f] = 2
+  deep[f] = frame[f] + best_d
+  return deep[f]
+}
+
+function chain(f, s) {
+  s = f
+  while (f in via) {
+    f = via[f]
+    s = s " > " f
+  }
+  return s
+}
+
+END {
+  if (!("main" in frame)) {
+    print "ramcheck: main not found" > "/dev/stderr"
+    exit 1
+  }
+  main_d = 2 + depth("main")  # called from .init9
+  if (model == "") printf "stack: main %d (%s)\n", main_d, chain("main")
+
+  for (f in frame) {
+    if (f !~ /^__vector_[0-9]+$/) continue
+    isr[++n_isr] = f
+    isr_d[n_isr] = 2 + depth(f)
+  }
+  worst = 0
+  for (i = 1; i <= n_isr; i++) {
+    d = isr_d[i]
+    nested = ""
+    if (first[isr[i]] == "sei") {
+      for (j = 1; j <= n_isr; j++) {
+        if (j != i && isr_d[j] > nest_d) {
+          nest_d = isr_d[j]
+          nested = isr[j]
+        }
+      }
+      d += nest_d
+      nest_d = 0
+    }
+    if (model == "")
+      printf "stack: %s %d%s\n", isr[i], isr_d[i],
+             nested != "" ? " + nested " nested : ""
+    if (d > worst) worst = d
+  }
+
+  total = static + main_d + worst
+  flash = num(flash)
+  if (model != "") {
+    printf "%-10s %6d %6d %6d %6d\n", model, text, flash - text, total,
+           budget - total
+  } else {
+    printf "RAM: %d static + %d stack = %d of %d bytes, %d left\n", static,
+           main_d + worst, total, budget, budget - total
+    printf "flash: %d of %d bytes, %d left\n", text, flash, flash - text
+  }
+  if (total > budget) {
+    print "ramcheck: RAM budget exceeded" > "/dev/stderr"
+    exit 1
+  }
+  if (text > flash) {
+    print "ramcheck: application overlaps the bootloader" > "/dev/stderr"
+    exit 1
+  }
+}
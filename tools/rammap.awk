@@ -0,0 +1,51 @@
+# Authors: tickelton@gmail.com
+# Licenses: GNU GPL version 2. See License.txt.
+# Copyright: (c) 2021 tickelton@gmail.com
+#
+# Static RAM of every module from 'avr-size -A' output of the object files:
+#
+#   avr-size -A src/*.o | awk -f rammap.awk
+#   avr-size -A src/*.o | awk -v header=1 -f rammap.awk > ram_map.h
+#
+# .data and .rodata (which the AVR keeps in RAM as well) count as data. The
+# table is printed, or with header=1 written as the PROGMEM tables read by
+# src/ram.c. Objects must be compiled with -fno-common, common symbols
+# don't show up in any section.
+
+/^[^ ]+ +:$/ {
+  name = $1
+  sub(/^.*\//, "", name)
+  sub(/\.o$/, "", name)
+  mod[++n] = name
+  next
+}
+
+n && $1 ~ /^\.(data|rodata)(\.|$)/ { data[n] += $2 }
+n && $1 ~ /^\.bss(\.|$)/ { bss[n] += $2 }
+
+END {
+  if (!header) {
+    printf "%-10s %5s %5s\n", "module", "data", "bss"
+    for (i = 1; i <= n; i++) {
+      printf "%-10s %5d %5d\n", mod[i], data[i], bss[i]
+      td += data[i]
+      tb += bss[i]
+    }
+    printf "%-10s %5d %5d\n", "total", td, tb
+    exit
+  }
+  for (i = 1; i <= n; i++) {
+    if (length(mod[i]) > 10 || data[i] > 255 || bss[i] > 255) {
+      print "rammap: " mod[i] " doesn't fit the table" > "/dev/stderr"
+      exit 1
+    }
+  }
+  print "// Generated by tools/rammap.awk, do not edit."
+  print "#define RAM_MODULES " n
+  print "static const char ram_names[] PROGMEM ="
+  for (i = 1; i <= n; i++)
+    printf "    \"%s\\0\"%s\n", mod[i], i < n ? "" : ";"
+  print "static const uint8_t ram_sizes[RAM_MODULES][2] PROGMEM = {"
+  for (i = 1; i <= n; i++) printf "    {%d, %d},\n", data[i], bss[i]
+  print "};"
+}
@@ -0,0 +1,140 @@
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * Generate the ADC to temperature table for the tip sensor.
+ *
+ *   sensorgen ntc R25 BETA RSERIES     NTC to GND, RSERIES to VCC
+ *   sensorgen tc_k GAIN AMBIENT        type K thermocouple, amplifier
+ *                                      gain, cold junction temperature
+ *   sensorgen linear T0 T1             T0 at ADC 0, T1 at ADC 1024
+ *
+ * The table is written to stdout as a C header with SENSOR_TABLE_LEN
+ * temperatures in 0.1 degrees C, one every 2^SENSOR_TABLE_SHIFT ADC counts.
+ * Table size and the largest interpolation error over all ADC codes are
+ * reported on stderr. The interpolation is the same integer math as in
+ * sensor_lookup(), the fraction is applied one bit at a time with a halving
+ * after each step so no multiplication and no 32 bit math is needed.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ADC_MAX 1024
+#define SHIFT 5
+#define LEN (ADC_MAX / (1 << SHIFT) + 1)
+#define T_MIN -400  // table is clamped to -40..600 C
+#define T_MAX 6000
+
+// NIST inverse polynomial for type K, 0..500 C, E in mV.
+static const double tc_k_inv[] = {0.0,          2.508355e1,   7.860106e-2,
+                                   -2.503131e-1, 8.315270e-2,  -1.228034e-2,
+                                   9.804036e-4,  -4.413030e-5, 1.057734e-6,
+                                   -1.052755e-8};
+// NIST polynomial for type K, 0..1372 C, without the exponential term.
+static const double tc_k_fwd[] = {
+    -1.7600413686e-2, 3.8921204975e-2,  1.8558770032e-5,
+    -9.9457592874e-8, 3.1840945719e-10, -5.6072844889e-13,
+    5.6075059059e-16, -3.2020720003e-19, 9.7151147152e-23,
+    -1.2104721275e-26};
+
+static double poly(const double *c, int n, double x) {
+  double r = 0;
+
+  while (n--) r = r * x + c[n];
+  return r;
+}
+
+static const char *type;
+static double p1, p2, p3;
+
+// Temperature in C for an ADC reading (0..1024), +-HUGE_VAL if out of range.
+static double temperature(double adc) {
+  if (strcmp(type, "ntc") == 0) {
+    double r;
+
+    if (adc <= 0) return HUGE_VAL;
+    if (adc >= ADC_MAX) return -HUGE_VAL;
+    r = p3 * adc / (ADC_MAX - adc);
+    return 1.0 / (1.0 / 298.15 + log(r / p1) / p2) - 273.15;
+  }
+  if (strcmp(type, "tc_k") == 0) {
+    double mv = adc * 5000.0 / ADC_MAX / p1;
+
+    // Add the cold junction voltage before inverting.
+    mv += poly(tc_k_fwd, 10, p2);
+    if (mv > 20.644) return HUGE_VAL;
+    return poly(tc_k_inv, 10, mv);
+  }
+  return p1 + (p2 - p1) * adc / ADC_MAX;  // linear
+}
+
+static int clamp(double t) {
+  t = round(t * 10);
+  return t < T_MIN ? T_MIN : t > T_MAX ? T_MAX : (int)t;
+}
+
+int main(int argc, char **argv) {
+  int table[LEN], i, adc;
+  double err = 0;
+  int err_at = 0, lo = -1, hi = -1;
+
+  if (argc < 4 || argc > 5 ||
+      (strcmp(argv[1], "ntc") && strcmp(argv[1], "tc_k") &&
+       strcmp(argv[1], "linear"))) {
+    fprintf(stderr,
+            "usage: %s ntc R25 BETA RSERIES | tc_k GAIN AMBIENT |"
+            " linear T0 T1\n",
+            argv[0]);
+    return 1;
+  }
+  type = argv[1];
+  p1 = atof(argv[2]);
+  p2 = atof(argv[3]);
+  p3 = argc > 4 ? atof(argv[4]) : 0;
+
+  for (i = 0; i < LEN; i++) {
+    table[i] = clamp(temperature(i << SHIFT));
+  }
+
+  for (adc = 0; adc < ADC_MAX; adc++) {
+    int t0 = table[adc >> SHIFT], t1 = table[(adc >> SHIFT) + 1];
+    int t = 0, bit;
+    double exact = temperature(adc);
+
+    for (bit = 0; bit < SHIFT; bit++) {
+      t = (t + (adc & (1 << bit) ? t1 - t0 : 0)) >> 1;
+    }
+    t += t0;
+
+    // Segments touching the clamped ends are outside the usable range.
+    if (t0 == T_MIN || t0 == T_MAX || t1 == T_MIN || t1 == T_MAX) continue;
+    if (lo < 0) lo = adc;
+    hi = adc;
+    if (fabs(t - exact * 10) > err) {
+      err = fabs(t - exact * 10);
+      err_at = adc;
+    }
+  }
+
+  printf("/* Generated by tools/sensorgen %s %s %s %s, don't edit. */\n",
+         argv[1], argv[2], argv[3], argc > 4 ? argv[4] : "");
+  printf("#define SENSOR_TABLE_SHIFT %d\n", SHIFT);
+  printf("#define SENSOR_TABLE_LEN %d\n", LEN);
+  printf("static const int16_t sensor_table[SENSOR_TABLE_LEN] PROGMEM = {");
+  for (i = 0; i < LEN; i++) {
+    printf("%s%d,", i % 8 ? " " : "\n    ", table[i]);
+  }
+  printf("\n};\n");
+
+  fprintf(stderr,
+          "sensor table (%s): %d entries, %d bytes PROGMEM\n"
+          "  usable ADC %d..%d (%.1f..%.1f C)\n"
+          "  max interpolation error %.1f C at ADC %d\n",
+          type, LEN, LEN * 2, lo, hi,
+          temperature(lo), temperature(hi), err / 10, err_at);
+  return 0;
+}
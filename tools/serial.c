@@ -0,0 +1,116 @@
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ */
+
+#include "serial.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SERIAL_TIMEOUT_MS 1000
+
+int serial_open(const char *path) {
+  struct termios tio;
+  int fd;
+
+  fd = open(path, O_RDWR | O_NOCTTY);
+  if (fd < 0) return -1;
+
+  if (tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  tcflush(fd, TCIOFLUSH);
+
+  return fd;
+}
+
+uint64_t serial_now_us(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int serial_cmd(int fd, const char *cmd, char *reply, size_t len, int lines,
+               int quiet_ms) {
+  char line[128];
+  size_t llen = 0, rlen = 0;
+  int got = 0, echo = 1;
+  uint64_t deadline;
+  struct pollfd pfd = {.fd = fd, .events = POLLIN};
+
+  if (write(fd, cmd, strlen(cmd)) < 0 || write(fd, "\r", 1) != 1) return -1;
+
+  if (len) reply[0] = '\0';
+  deadline = serial_now_us() + SERIAL_TIMEOUT_MS * 1000;
+
+  for (;;) {
+    int64_t left = (int64_t)(deadline - serial_now_us()) / 1000;
+    int wait = lines ? (int)left : quiet_ms;
+    char c;
+
+    if (left <= 0) return lines ? -1 : got;
+    if (poll(&pfd, 1, wait < left ? wait : (int)left) <= 0) {
+      if (!lines && left > 0) return got;
+      continue;
+    }
+    if (read(fd, &c, 1) != 1) return -1;
+
+    if (c != '\r' && c != '\n') {
+      if (llen < sizeof(line) - 1) line[llen++] = c;
+      continue;
+    }
+    if (llen == 0) continue;
+    line[llen] = '\0';
+    llen = 0;
+
+    if (echo && strcmp(line, cmd) == 0) {
+      echo = 0;
+      continue;
+    }
+    if (line[0] == '\\') continue;  // asynchronous event
+
+    if (rlen + strlen(line) + 2 <= len) {
+      if (rlen) reply[rlen++] = '\n';
+      strcpy(reply + rlen, line);
+      rlen += strlen(line);
+    }
+    if (++got == lines) return got;
+  }
+}
+
+int64_t serial_exchange(int fd, const char *cmd, char *buf, size_t expect) {
+  struct pollfd pfd = {.fd = fd, .events = POLLIN};
+  uint64_t start, deadline;
+  size_t got = 0;
+  char out[64];
+  size_t len = strlen(cmd);
+
+  if (len + 1 > sizeof(out)) return -1;
+  memcpy(out, cmd, len);
+  out[len++] = '\r';
+
+  start = serial_now_us();
+  deadline = start + SERIAL_TIMEOUT_MS * 1000;
+  if (write(fd, out, len) != (ssize_t)len) return -1;
+
+  while (got < expect) {
+    int64_t left = (int64_t)(deadline - serial_now_us()) / 1000;
+    ssize_t n;
+
+    if (left <= 0 || poll(&pfd, 1, (int)left) <= 0) return -1;
+    n = read(fd, buf + got, expect - got);
+    if (n <= 0) return -1;
+    got += n;
+  }
+  return (int64_t)(serial_now_us() - start);
+}
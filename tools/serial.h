@@ -0,0 +1,36 @@
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * Host side access to the soldering iron's virtual COM port.
+ */
+
+#ifndef __SERIAL_H__
+#define __SERIAL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Open a tty in raw mode. Returns the file descriptor or -1.
+int serial_open(const char *path);
+
+// Send 'cmd' terminated by CR and collect the reply.
+//
+// The device echoes every character it receives, the echo and asynchronous
+// event lines (starting with '\') are dropped. Reply lines are stored in
+// 'reply' separated by '\n'. Reading stops after 'lines' reply lines, or if
+// 'lines' is 0, once the device was quiet for 'quiet_ms'.
+// Returns the number of reply lines or -1 on error or timeout.
+int serial_cmd(int fd, const char *cmd, char *reply, size_t len, int lines,
+               int quiet_ms);
+
+// Send 'cmd' terminated by CR and read exactly 'expect' bytes of raw reply
+// (including the echo) into 'buf'.
+// Returns the round trip time in microseconds or -1 on error or timeout.
+int64_t serial_exchange(int fd, const char *cmd, char *buf, size_t expect);
+
+// Monotonic time in microseconds.
+uint64_t serial_now_us(void);
+
+#endif  // __SERIAL_H__
@@ -0,0 +1,371 @@
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * Timing regression test running the unmodified firmware in simavr.
+ *
+ *   simtest [-o report] [-v trace.vcd] Soldering.elf
+ *
+ * The firmware is simulated cycle by cycle without a USB host. The test
+ *  - checks that hardwareInit() holds the USB lines for ~300ms,
+ *  - presses the button and measures the time until pwr_idx changes,
+ *  - measures period and on-time of the heater PWM on PB1 and compares
+ *    them to HEATER_PWM_SHIFT of the model and the duty cycle the firmware
+ *    computed (heater_duty),
+ *  - arms a sensor capture twice in a row ("01 a") through the RX ring and
+ *    checks that the firmware isn't reset by the watchdog,
+ *  - records the longest run time of every interrupt handler,
+ *  - hands a full and an empty OUT packet to usbPoll() and measures the run
+ *    time of usbFunctionWriteOut(), interrupts not included.
+ * PB1 (MOSFET) and PB4 (LED) are traced to a VCD file. The timing report
+ * is written as 'key value' lines so it can be diffed between commits.
+ * The exit status is 1 if any check fails.
+ */
+
+#include <fcntl.h>
+#include <gelf.h>
+#include <libelf.h>
+#include <simavr/avr_ioport.h>
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_interrupts.h>
+#include <simavr/sim_vcd_file.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "model.h"
+
+#define F_CPU 16500000
+#define US(c) ((double)(c)*1e6 / F_CPU)
+#define CYCLES_MS(ms) ((avr_cycle_count_t)(ms) * (F_CPU / 1000))
+
+#define PIN_MOSFET 1
+#define PIN_BUTTON 3
+#define PIN_LED 4
+#define USB_MASK ((1 << 0) | (1 << 2))  // D- and D+
+#define RXBUF_MSK 15                    // src/cdc.h
+#define USB_BUFSIZE 11                  // v-usb/usbdrv/usbdrv.h
+#define USB_OUT_EP 1                    // usbRxToken: OUT on endpoint 1
+
+// Limits
+#define PWM_OVF_CYCLES 65536UL  // TIMER0 overflow, the heater switches on it
+#define PWM_STEP_CYCLES (PWM_OVF_CYCLES >> HEATER_PWM_SHIFT)  // one duty step
+#define PWM_PERIOD_CYCLES (256 * PWM_STEP_CYCLES)
+#define PWM_PERIOD_TOL (PWM_PERIOD_CYCLES / 200)  // 0.5%
+#define DISCONNECT_MIN_MS 299
+#define BUTTON_MAX_MS 60
+#define ISR_MAX_CYCLES 400
+#define RX_CALLBACK_MAX_CYCLES 250  // 8 bytes, ~15us
+
+#define PRESS_AT_MS 500
+#define PRESS_FOR_MS 100
+#define RUN_MS 4200  // at least three PWM periods after the press
+#define REARM_MS 1500  // longer than the 1s watchdog
+
+static const struct {
+  uint8_t vector;
+  const char *name;
+} isrs[] = {
+    {2, "pcint0"}, {4, "timer1_ovf"}, {5, "timer0_ovf"}, {8, "adc"},
+};
+#define N_ISRS (sizeof(isrs) / sizeof(isrs[0]))
+
+static avr_t *avr;
+static avr_cycle_count_t isr_start[N_ISRS], isr_max[N_ISRS], isr_total;
+static long writeout;  // usbFunctionWriteOut()
+static uint16_t writeout_sp;
+static avr_cycle_count_t writeout_start, writeout_isr, writeout_last;
+static avr_cycle_count_t usb_assert, usb_release, on_edge[4], off_edge[4];
+static int n_on, n_off;
+static int usb_held, boots;
+static FILE *report;
+static int failed;
+
+static void isr_notify(avr_irq_t *irq, uint32_t value, void *param) {
+  int i = (int)(intptr_t)param;
+
+  if (value) {
+    isr_start[i] = avr->cycle;
+    return;
+  }
+  isr_total += avr->cycle - isr_start[i];
+  if (avr->cycle - isr_start[i] > isr_max[i]) {
+    isr_max[i] = avr->cycle - isr_start[i];
+  }
+}
+
+static void ddr_notify(avr_irq_t *irq, uint32_t value, void *param) {
+  int held = (value & USB_MASK) == USB_MASK;
+
+  if (held && !usb_held) boots++;  // hardwareInit() runs after every reset
+  usb_held = held;
+  if (!usb_assert && held) {
+    usb_assert = avr->cycle;
+  } else if (usb_assert && !usb_release && !(value & USB_MASK)) {
+    usb_release = avr->cycle;
+  }
+}
+
+// The heater is on while PB1 is low.
+static void mosfet_notify(avr_irq_t *irq, uint32_t value, void *param) {
+  if (!value && n_on < 4) on_edge[n_on++] = avr->cycle;
+  if (value && n_on > n_off && n_off < 4) off_edge[n_off++] = avr->cycle;
+}
+
+// Address of a variable in the data space or of a function in flash.
+static long symbol(const char *path, const char *name) {
+  Elf *e;
+  Elf_Scn *scn = NULL;
+  GElf_Shdr sh;
+  GElf_Sym sym;
+  long addr = -1;
+  int fd = open(path, O_RDONLY), i;
+
+  if (fd < 0 || elf_version(EV_CURRENT) == EV_NONE) return -1;
+  e = elf_begin(fd, ELF_C_READ, NULL);
+  while (e && addr < 0 && (scn = elf_nextscn(e, scn)) != NULL) {
+    Elf_Data *data;
+
+    if (!gelf_getshdr(scn, &sh) || sh.sh_type != SHT_SYMTAB) continue;
+    data = elf_getdata(scn, NULL);
+    for (i = 0; data && i < (int)(sh.sh_size / sh.sh_entsize); i++) {
+      gelf_getsym(data, i, &sym);
+      if (strcmp(elf_strptr(e, sh.sh_link, sym.st_name), name) == 0) {
+        addr = sym.st_value & 0xFFFF;  // strip the 0x800000 data offset
+        break;
+      }
+    }
+  }
+  if (e) elf_end(e);
+  close(fd);
+  return addr;
+}
+
+// Queue 'cmd' in the RX ring as if it arrived in an OUT packet.
+static void send(long rxbuf, long rxw, const char *cmd) {
+  uint8_t w = avr->data[rxw];
+
+  while (*cmd) avr->data[rxbuf + (w++ & RXBUF_MSK)] = *cmd++;
+  avr->data[rxw] = w;
+}
+
+// Hand 'len' bytes to usbPoll() as if the USB interrupt had received an OUT
+// packet. The data goes after the PID in the buffer the interrupt isn't
+// using, CRCs aren't checked. Returns -1 if the buffer is busy or flow
+// control is asserted.
+static int packet(const long *usb, const char *data, uint8_t len) {
+  long buf = usb[0] + USB_BUFSIZE + 1 - avr->data[usb[3]];
+
+  if (avr->data[usb[1]] != 0) return -1;
+  memcpy(&avr->data[buf], data, len);
+  avr->data[usb[2]] = USB_OUT_EP;
+  avr->data[usb[1]] = len + 3;
+  return 0;
+}
+
+// Time usbFunctionWriteOut() from its first instruction until it returned,
+// i.e. the stack pointer is above its value on entry again.
+static void writeout_step(void) {
+  uint16_t sp = avr->data[R_SPL] | avr->data[R_SPH] << 8;
+
+  if (!writeout_sp && avr->pc == writeout) {
+    writeout_sp = sp;
+    writeout_start = avr->cycle;
+    writeout_isr = isr_total;
+  } else if (writeout_sp && sp > writeout_sp) {
+    writeout_last = avr->cycle - writeout_start - (isr_total - writeout_isr);
+    writeout_sp = 0;
+  }
+}
+
+static void check(const char *key, double value, int ok) {
+  fprintf(report, "%s %.0f\n", key, value);
+  if (!ok) {
+    fprintf(stderr, "FAIL %s %.0f\n", key, value);
+    failed = 1;
+  }
+}
+
+static int run_until(avr_cycle_count_t end) {
+  while (avr->cycle < end) {
+    int state = avr_run(avr);
+
+    if (state == cpu_Done || state == cpu_Crashed) return -1;
+    writeout_step();
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  const char *vcd_path = "simtest.vcd", *out = NULL;
+  elf_firmware_t fw;
+  avr_vcd_t vcd;
+  avr_irq_t *button;
+  avr_cycle_count_t pressed, changed = 0;
+  long pwr_idx, heater_duty, rxbuf, rxw, usb[4];
+  avr_cycle_count_t full;
+  uint8_t idx0;
+  unsigned i;
+  int opt, n;
+
+  while ((opt = getopt(argc, argv, "o:v:")) != -1) {
+    switch (opt) {
+      case 'o':
+        out = optarg;
+        break;
+      case 'v':
+        vcd_path = optarg;
+        break;
+      default:
+        goto usage;
+    }
+  }
+  if (optind != argc - 1) goto usage;
+
+  report = out ? fopen(out, "w") : stdout;
+  if (!report) {
+    perror(out);
+    return 1;
+  }
+
+  pwr_idx = symbol(argv[optind], "pwr_idx");
+  heater_duty = symbol(argv[optind], "heater_duty");
+  rxbuf = symbol(argv[optind], "rxbuf");
+  rxw = symbol(argv[optind], "rxw");
+  usb[0] = symbol(argv[optind], "usbRxBuf");
+  usb[1] = symbol(argv[optind], "usbRxLen");
+  usb[2] = symbol(argv[optind], "usbRxToken");
+  usb[3] = symbol(argv[optind], "usbInputBufOffset");
+  writeout = symbol(argv[optind], "usbFunctionWriteOut");
+  if (pwr_idx < 0 || heater_duty < 0 || rxbuf < 0 || rxw < 0 ||
+      usb[0] < 0 || usb[1] < 0 || usb[2] < 0 || usb[3] < 0 || writeout < 0) {
+    fprintf(stderr, "%s: symbols not found\n", argv[optind]);
+    return 1;
+  }
+
+  memset(&fw, 0, sizeof(fw));
+  if (elf_read_firmware(argv[optind], &fw) != 0) {
+    fprintf(stderr, "%s: can't load\n", argv[optind]);
+    return 1;
+  }
+  strcpy(fw.mmcu, "attiny85");
+  fw.frequency = F_CPU;
+
+  avr = avr_make_mcu_by_name(fw.mmcu);
+  if (!avr) return 1;
+  avr_init(avr);
+  avr_load_firmware(avr, &fw);
+  avr->vcc = avr->avcc = avr->aref = 5000;
+
+  avr_vcd_init(avr, vcd_path, &vcd, 1000);
+  avr_vcd_add_signal(
+      &vcd, avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), PIN_MOSFET), 1,
+      "PB1");
+  avr_vcd_add_signal(
+      &vcd, avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), PIN_LED), 1,
+      "PB4");
+  avr_vcd_start(&vcd);
+
+  for (i = 0; i < N_ISRS; i++) {
+    avr_irq_t *irq = avr_get_interrupt_irq(avr, isrs[i].vector);
+
+    if (irq) {
+      avr_irq_register_notify(irq + AVR_INT_IRQ_RUNNING, isr_notify,
+                              (void *)(intptr_t)i);
+    }
+  }
+  avr_irq_register_notify(
+      avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'),
+                    IOPORT_IRQ_DIRECTION_ALL),
+      ddr_notify, NULL);
+
+  button = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), PIN_BUTTON);
+  avr_raise_irq(button, 1);
+
+  // Boot and USB disconnect
+  if (run_until(CYCLES_MS(PRESS_AT_MS))) goto crashed;
+  check("usb_disconnect_ms", US(usb_release - usb_assert) / 1000,
+        usb_release &&
+            usb_release - usb_assert >= CYCLES_MS(DISCONNECT_MIN_MS));
+
+  // Button press, preset 0 (off) -> 1
+  idx0 = avr->data[pwr_idx];
+  pressed = avr->cycle;
+  avr_raise_irq(button, 0);
+  while (avr->cycle < pressed + CYCLES_MS(PRESS_FOR_MS)) {
+    if (run_until(avr->cycle + CYCLES_MS(1))) goto crashed;
+    if (!changed && avr->data[pwr_idx] != idx0) changed = avr->cycle;
+  }
+  avr_raise_irq(button, 1);
+  check("button_latency_us", changed ? US(changed - pressed) : -1,
+        changed && changed - pressed <= CYCLES_MS(BUTTON_MAX_MS));
+
+  // PWM
+  avr_irq_register_notify(
+      avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), PIN_MOSFET),
+      mosfet_notify, NULL);
+  if (run_until(CYCLES_MS(RUN_MS))) goto crashed;
+
+  if (n_on >= 3 && n_off >= 2) {
+    avr_cycle_count_t period = on_edge[2] - on_edge[1];
+    avr_cycle_count_t on = off_edge[1] - on_edge[1];
+    double expect = (double)avr->data[heater_duty] * PWM_STEP_CYCLES;
+
+    check("pwm_period_cycles", period,
+          period + PWM_PERIOD_TOL >= PWM_PERIOD_CYCLES &&
+              period <= PWM_PERIOD_CYCLES + PWM_PERIOD_TOL);
+    check("pwm_duty", avr->data[heater_duty], 1);
+    check("pwm_on_cycles", on,
+          on + PWM_OVF_CYCLES >= expect && on <= expect + PWM_OVF_CYCLES);
+  } else {
+    check("pwm_edges", n_on + n_off, 0);
+  }
+
+  // Re-arm a running capture, the free running ADC must be stopped first.
+  n = boots;
+  send(rxbuf, rxw, "01 a\r01 a\r");
+  if (run_until(avr->cycle + CYCLES_MS(REARM_MS))) goto crashed;
+  check("capture_rearm_resets", boots - n, boots == n);
+
+  // USB receive callback, spaces are only echoed. An empty packet must not
+  // take longer than a full one.
+  writeout_last = 0;
+  if (packet(usb, "        ", 8) == 0) {
+    if (run_until(avr->cycle + CYCLES_MS(10))) goto crashed;
+  }
+  full = writeout_last;
+  check("rx_callback_max_cycles", full,
+        full && full <= RX_CALLBACK_MAX_CYCLES);
+  writeout_last = 0;
+  if (packet(usb, "", 0) == 0) {
+    if (run_until(avr->cycle + CYCLES_MS(10))) goto crashed;
+  }
+  check("rx_callback_empty_cycles", writeout_last,
+        writeout_last && writeout_last < full);
+
+  for (i = 0; i < N_ISRS; i++) {
+    char key[48];
+
+    snprintf(key, sizeof(key), "isr_%s_max_cycles", isrs[i].name);
+    check(key, isr_max[i], isr_max[i] <= ISR_MAX_CYCLES);
+  }
+
+  avr_vcd_stop(&vcd);
+  if (report != stdout) fclose(report);
+  return failed;
+
+crashed:
+  fprintf(stderr, "firmware crashed at cycle %llu\n",
+          (unsigned long long)avr->cycle);
+  avr_vcd_stop(&vcd);
+  return 1;
+
+usage:
+  fprintf(stderr, "usage: %s [-o report] [-v trace.vcd] firmware.elf\n",
+          argv[0]);
+  return 1;
+}
@@ -0,0 +1,191 @@
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ */
+
+#include "tellog.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TELLOG_MAGIC "TELLOG1"
+
+struct tellog_idx {
+  char magic[8];
+  uint64_t count;
+  int64_t first[];  // time of the first record of each block
+};
+
+static const struct {
+  const char *name;
+  size_t width;
+  size_t col;  // offset of the column pointer in tellog_t
+  size_t rec;  // offset of the value in tellog_rec_t
+} columns[TELLOG_COLUMNS] = {
+#define COL(n) \
+  {#n, sizeof(((tellog_rec_t *)0)->n), offsetof(tellog_t, n), \
+   offsetof(tellog_rec_t, n)}
+    COL(time_us), COL(dev_ms), COL(duty), COL(heater),
+    COL(reading), COL(temp),   COL(mv),   COL(state),
+#undef COL
+};
+
+static void **column(tellog_t *log, int c) {
+  return (void **)((char *)log + columns[c].col);
+}
+
+static size_t idx_size(uint64_t cap) {
+  return sizeof(struct tellog_idx) + cap / TELLOG_BLOCK * sizeof(int64_t);
+}
+
+static void *remap(void *old, size_t old_len, int fd, size_t len,
+                   int writable) {
+  void *p;
+
+  if (old) munmap(old, old_len);
+  if (len == 0) return NULL;
+  if (writable && ftruncate(fd, (off_t)len)) return MAP_FAILED;
+  p = mmap(NULL, len, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+           MAP_SHARED, fd, 0);
+  return p;
+}
+
+// Map all files for 'cap' records, growing them if writable.
+static int map_all(tellog_t *log, uint64_t cap) {
+  void *p;
+  int c;
+
+  for (c = 0; c < TELLOG_COLUMNS; c++) {
+    void **col = column(log, c);
+
+    p = remap(*col, log->cap * columns[c].width, log->fd[c],
+              cap * columns[c].width, log->writable);
+    *col = p;
+    if (p == MAP_FAILED) return -1;
+  }
+  p = remap(log->idx, log->idx_size, log->idx_fd, idx_size(cap),
+            log->writable);
+  log->idx = p;
+  log->idx_size = idx_size(cap);
+  log->cap = cap;
+  return p == MAP_FAILED ? -1 : 0;
+}
+
+int tellog_open(tellog_t *log, const char *dir, const char *station,
+                int writable) {
+  char path[PATH_MAX];
+  int flags = writable ? O_RDWR | O_CREAT : O_RDONLY;
+  struct stat st;
+  uint64_t cap;
+  int c;
+
+  memset(log, 0, sizeof(*log));
+  log->writable = writable;
+  for (c = 0; c < TELLOG_COLUMNS; c++) log->fd[c] = -1;
+
+  snprintf(path, sizeof(path), "%s/%s.idx", dir, station);
+  log->idx_fd = open(path, flags, 0644);
+  if (log->idx_fd < 0) return -1;
+  for (c = 0; c < TELLOG_COLUMNS; c++) {
+    snprintf(path, sizeof(path), "%s/%s.%s", dir, station, columns[c].name);
+    log->fd[c] = open(path, flags, 0644);
+    if (log->fd[c] < 0) goto err;
+  }
+
+  // The time column is grown first, it limits the usable capacity.
+  if (fstat(log->fd[0], &st)) goto err;
+  cap = (uint64_t)st.st_size / sizeof(int64_t);
+  if (cap == 0 && !writable) {
+    errno = ENOENT;
+    goto err;
+  }
+  if (cap == 0) cap = TELLOG_GROW;
+  if (map_all(log, cap)) goto err;
+
+  if (memcmp(log->idx->magic, TELLOG_MAGIC, 8) != 0) {
+    if (!writable || log->idx->count) {
+      errno = EINVAL;
+      goto err;
+    }
+    memcpy(log->idx->magic, TELLOG_MAGIC, 8);
+  }
+  return 0;
+
+err:
+  c = errno;
+  tellog_close(log);
+  errno = c;
+  return -1;
+}
+
+uint64_t tellog_count(const tellog_t *log) {
+  // A writer may have grown the files after they were mapped here.
+  return log->idx->count < log->cap ? log->idx->count : log->cap;
+}
+
+int tellog_append(tellog_t *log, const tellog_rec_t *rec) {
+  uint64_t n = log->idx->count;
+  int c;
+
+  if (!log->writable || (n && rec->time_us < log->time_us[n - 1])) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (n == log->cap && map_all(log, log->cap + TELLOG_GROW)) return -1;
+
+  for (c = 0; c < TELLOG_COLUMNS; c++) {
+    memcpy((char *)*column(log, c) + n * columns[c].width,
+           (const char *)rec + columns[c].rec, columns[c].width);
+  }
+  if (n % TELLOG_BLOCK == 0) log->idx->first[n / TELLOG_BLOCK] = rec->time_us;
+  __atomic_store_n(&log->idx->count, n + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+uint64_t tellog_find(const tellog_t *log, int64_t time_us) {
+  uint64_t n = tellog_count(log), lo = 0, hi, mid;
+
+  // Last block that starts before 'time_us'...
+  hi = (n + TELLOG_BLOCK - 1) / TELLOG_BLOCK;
+  while (hi - lo > 1) {
+    mid = (lo + hi) / 2;
+    if (log->idx->first[mid] < time_us) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  // ...then the first record within it.
+  lo *= TELLOG_BLOCK;
+  hi = lo + TELLOG_BLOCK < n ? lo + TELLOG_BLOCK : n;
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (log->time_us[mid] < time_us) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+void tellog_close(tellog_t *log) {
+  int c;
+
+  for (c = 0; c < TELLOG_COLUMNS; c++) {
+    void **col = column(log, c);
+
+    if (*col && *col != MAP_FAILED) munmap(*col, log->cap * columns[c].width);
+    if (log->fd[c] >= 0) close(log->fd[c]);
+  }
+  if (log->idx && log->idx != MAP_FAILED) munmap(log->idx, log->idx_size);
+  if (log->idx_fd >= 0) close(log->idx_fd);
+  memset(log, 0, sizeof(*log));
+}
@@ -0,0 +1,73 @@
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * Memory-mapped columnar telemetry log, one per station.
+ *
+ * Every column is a file '<dir>/<station>.<column>' of fixed-width values,
+ * record i is at offset i * width in each of them. '<station>.idx' holds a
+ * header with the record count and the time of the first record of every
+ * block of TELLOG_BLOCK records, so a time range is found by a binary search
+ * over the index and one block of the time column. Queries only touch the
+ * pages of the columns they use.
+ *
+ * Records must be appended in time order. The count is updated after the
+ * columns, a record is either complete or not there after a crash.
+ */
+
+#ifndef __TELLOG_H__
+#define __TELLOG_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TELLOG_BLOCK 1024  // records per time index entry
+#define TELLOG_GROW 65536  // records added per file extension
+#define TELLOG_COLUMNS 8
+
+typedef struct {
+  int64_t time_us;   // host time, microseconds since the epoch
+  uint32_t dev_ms;   // device time ('c')
+  uint8_t duty;      // selected duty cycle ('g')
+  uint8_t heater;    // applied duty cycle after supply compensation
+  uint16_t reading;  // filtered sensor reading in ADC counts
+  int16_t temp;      // 0.1 degrees C
+  uint16_t mv;       // supply voltage
+  uint8_t state;     // standby state, see src/standby.h
+} tellog_rec_t;
+
+typedef struct {
+  int writable;
+  uint64_t cap;  // records the column files can hold
+  struct tellog_idx *idx;
+  size_t idx_size;
+  int idx_fd;
+  int fd[TELLOG_COLUMNS];
+  // Column arrays, valid for tellog_count() records.
+  int64_t *time_us;
+  uint32_t *dev_ms;
+  uint8_t *duty;
+  uint8_t *heater;
+  uint16_t *reading;
+  int16_t *temp;
+  uint16_t *mv;
+  uint8_t *state;
+} tellog_t;
+
+// Open the log of 'station' in 'dir', creating it if 'writable'.
+// Returns 0 or -1 with errno set.
+int tellog_open(tellog_t *log, const char *dir, const char *station,
+                int writable);
+
+// Append one record. Fails with EINVAL if it is older than the last one.
+int tellog_append(tellog_t *log, const tellog_rec_t *rec);
+
+uint64_t tellog_count(const tellog_t *log);
+
+// Index of the first record at or after 'time_us' (tellog_count() if none).
+uint64_t tellog_find(const tellog_t *log, int64_t time_us);
+
+void tellog_close(tellog_t *log);
+
+#endif  // __TELLOG_H__
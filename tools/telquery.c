@@ -0,0 +1,121 @@
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * Aggregate a time window of the telemetry logs written by telrec.
+ *
+ *   telquery [-d dir] [-f from] [-t to] [-l low] [-h high] [-r ohm]
+ *            station...
+ *
+ * 'from' and 'to' are seconds since the epoch, or if negative, relative to
+ * the last record of the station; the default is the whole log. For every
+ * station the number of records, the time spent between 'low' and 'high'
+ * degrees C (default 300..400), the mean and peak temperature and the
+ * heater energy are printed. The energy is integrated from the applied duty
+ * cycle and the supply voltage of each record over a heater of 'ohm'
+ * (default 3.1) Ohm. Gaps of more than MAX_GAP_S seconds, i.e. the
+ * recorder wasn't running, are not counted.
+ *
+ * Only the time index and the time, temp, heater and mv columns are read.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tellog.h"
+
+#define MAX_GAP_S 10.0
+
+static int64_t window(const tellog_t *log, double t) {
+  uint64_t n = tellog_count(log);
+
+  if (t >= 0) return (int64_t)(t * 1e6);
+  return (n ? log->time_us[n - 1] : 0) + (int64_t)(t * 1e6);
+}
+
+static void query(const tellog_t *log, const char *name, double from,
+                  double to, double low, double high, double ohm) {
+  uint64_t i, first, last, n = tellog_count(log);
+  double dt, at_temp = 0, span = 0, energy = 0, sum = 0, v;
+  int16_t peak = INT16_MIN;
+
+  first = from != 0 ? tellog_find(log, window(log, from)) : 0;
+  last = to != 0 ? tellog_find(log, window(log, to) + 1) : n;
+
+  for (i = first; i < last; i++) {
+    // Each record holds until the next one.
+    dt = i + 1 < n ? (log->time_us[i + 1] - log->time_us[i]) / 1e6 : 0;
+    if (dt > MAX_GAP_S) dt = 0;
+    span += dt;
+
+    sum += log->temp[i] / 10.0 * dt;
+    if (log->temp[i] > peak) peak = log->temp[i];
+    if (log->temp[i] >= low * 10 && log->temp[i] <= high * 10) at_temp += dt;
+
+    v = log->mv[i] / 1000.0;
+    energy += v * v / ohm * log->heater[i] / 256.0 * dt;
+  }
+
+  printf("%s: %llu records, %.0f s\n", name,
+         (unsigned long long)(last - first), span);
+  if (last == first) return;
+  printf("  at %g..%g C: %.0f s (%.1f%%)\n", low, high, at_temp,
+         span > 0 ? at_temp * 100 / span : 0.0);
+  printf("  temperature: mean %.1f C, peak %.1f C\n",
+         span > 0 ? sum / span : log->temp[first] / 10.0, peak / 10.0);
+  printf("  energy: %.0f J (%.3f Wh)\n", energy, energy / 3600);
+}
+
+int main(int argc, char **argv) {
+  const char *dir = ".";
+  double from = 0, to = 0, low = 300, high = 400, ohm = 3.1;
+  int opt, i, ret = 0;
+  tellog_t log;
+
+  while ((opt = getopt(argc, argv, "d:f:t:l:h:r:")) != -1) {
+    switch (opt) {
+      case 'd':
+        dir = optarg;
+        break;
+      case 'f':
+        from = atof(optarg);
+        break;
+      case 't':
+        to = atof(optarg);
+        break;
+      case 'l':
+        low = atof(optarg);
+        break;
+      case 'h':
+        high = atof(optarg);
+        break;
+      case 'r':
+        ohm = atof(optarg);
+        break;
+      default:
+        optind = argc + 1;
+    }
+  }
+  if (optind >= argc || ohm <= 0) {
+    fprintf(stderr,
+            "usage: %s [-d dir] [-f from] [-t to] [-l low] [-h high]"
+            " [-r ohm] station...\n",
+            argv[0]);
+    return 1;
+  }
+
+  for (i = optind; i < argc; i++) {
+    if (tellog_open(&log, dir, argv[i], 0)) {
+      fprintf(stderr, "%s/%s: %s\n", dir, argv[i], strerror(errno));
+      ret = 1;
+      continue;
+    }
+    query(&log, argv[i], from, to, low, high, ohm);
+    tellog_close(&log);
+  }
+  return ret;
+}
@@ -0,0 +1,217 @@
+/*
+ * Authors: tickelton@gmail.com
+ * Licenses: GNU GPL version 2. See License.txt.
+ * Copyright: (c) 2021 tickelton@gmail.com
+ *
+ * Record the telemetry of many irons into columnar logs, see tellog.h.
+ *
+ *   telrec [-d dir] [-i ms] [station=]tty...   poll 'd', 'v' and 'b'
+ *   telrec [-d dir] -                          read records from stdin
+ *
+ * The station name defaults to the tty name without '/dev/', other slashes
+ * replaced by '_'. Records read from stdin are lines of 'station time_us
+ * dev_ms duty heater reading temp mv state' in decimal, for collectors that
+ * already have the data. Every iron is polled by its own thread so a slow or
+ * unplugged iron doesn't delay the others. The recorder runs until it is
+ * interrupted.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "serial.h"
+#include "tellog.h"
+
+#define MAX_STATIONS 64
+
+typedef struct {
+  char name[64];
+  const char *tty;
+  int fd;
+  pthread_t thread;
+  tellog_t log;
+} station_t;
+
+static station_t stations[MAX_STATIONS];
+static int n_stations;
+static const char *dir = ".";
+static int interval_ms = 1000;
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig) {
+  (void)sig;
+  stop = 1;
+}
+
+static int64_t wall_us(void) {
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static station_t *station(const char *name) {
+  station_t *s;
+  int i;
+
+  for (i = 0; i < n_stations; i++) {
+    if (strcmp(stations[i].name, name) == 0) return &stations[i];
+  }
+  if (n_stations == MAX_STATIONS || strchr(name, '/')) return NULL;
+
+  s = &stations[n_stations];
+  snprintf(s->name, sizeof(s->name), "%s", name);
+  if (tellog_open(&s->log, dir, s->name, 1)) {
+    fprintf(stderr, "%s/%s: %s\n", dir, s->name, strerror(errno));
+    return NULL;
+  }
+  n_stations++;
+  return s;
+}
+
+// Poll one iron. Returns 0 if a record was appended.
+static int poll_iron(station_t *s) {
+  char reply[64];
+  unsigned ms, duty, reading, temp, mv, factor, heater, state, timeout;
+  tellog_rec_t rec;
+
+  rec.time_us = wall_us();
+  if (serial_cmd(s->fd, "d", reply, sizeof(reply), 1, 0) != 1 ||
+      sscanf(reply, "%8x %2x %4x %4x", &ms, &duty, &reading, &temp) != 4) {
+    return -1;
+  }
+  if (serial_cmd(s->fd, "v", reply, sizeof(reply), 1, 0) != 1 ||
+      sscanf(reply, "%4x %4x %2x", &mv, &factor, &heater) != 3) {
+    return -1;
+  }
+  if (serial_cmd(s->fd, "b", reply, sizeof(reply), 1, 0) != 1 ||
+      sscanf(reply, "%2x %2x", &state, &timeout) != 2) {
+    return -1;
+  }
+  rec.dev_ms = ms;
+  rec.duty = duty;
+  rec.heater = heater;
+  rec.reading = reading;
+  rec.temp = (int16_t)temp;
+  rec.mv = mv;
+  rec.state = state;
+  return tellog_append(&s->log, &rec);
+}
+
+static void *poll_thread(void *arg) {
+  station_t *s = arg;
+  uint64_t next = serial_now_us();
+
+  while (!stop) {
+    if (poll_iron(s)) fprintf(stderr, "%s: no sample\n", s->name);
+    next += (uint64_t)interval_ms * 1000;
+    if (next > serial_now_us()) {
+      usleep(next - serial_now_us());
+    } else {
+      next = serial_now_us();  // fell behind, don't try to catch up
+    }
+  }
+  return NULL;
+}
+
+static int record_stdin(void) {
+  char line[256], name[64];
+  long long t;
+  unsigned ms, duty, heater, reading, mv, state;
+  int temp, n = 0;
+  tellog_rec_t rec;
+  station_t *s;
+
+  while (!stop && fgets(line, sizeof(line), stdin)) {
+    if (sscanf(line, "%63s %lld %u %u %u %u %d %u %u", name, &t, &ms, &duty,
+               &heater, &reading, &temp, &mv, &state) != 9) {
+      fprintf(stderr, "bad record: %s", line);
+      continue;
+    }
+    rec.time_us = t;
+    rec.dev_ms = ms;
+    rec.duty = duty;
+    rec.heater = heater;
+    rec.reading = reading;
+    rec.temp = temp;
+    rec.mv = mv;
+    rec.state = state;
+    if (!(s = station(name)) || tellog_append(&s->log, &rec)) {
+      fprintf(stderr, "%s: record dropped: %s\n", name, strerror(errno));
+      continue;
+    }
+    n++;
+  }
+  fprintf(stderr, "%d records\n", n);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int opt, i;
+
+  while ((opt = getopt(argc, argv, "d:i:")) != -1) {
+    switch (opt) {
+      case 'd':
+        dir = optarg;
+        break;
+      case 'i':
+        interval_ms = atoi(optarg);
+        break;
+      default:
+        optind = argc + 1;
+    }
+  }
+  if (optind >= argc || interval_ms <= 0) {
+    fprintf(stderr,
+            "usage: %s [-d dir] [-i ms] [station=]tty... | [-d dir] -\n",
+            argv[0]);
+    return 1;
+  }
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
+  if (strcmp(argv[optind], "-") == 0) return record_stdin();
+
+  for (i = optind; i < argc; i++) {
+    char *eq = strchr(argv[i], '=');
+    const char *tty = eq ? eq + 1 : argv[i];
+    char name[64], *p;
+    station_t *s;
+
+    if (eq) {
+      snprintf(name, sizeof(name), "%.*s", (int)(eq - argv[i]), argv[i]);
+    } else {
+      snprintf(name, sizeof(name), "%s",
+               strncmp(tty, "/dev/", 5) == 0 ? tty + 5 : tty);
+      while ((p = strchr(name, '/'))) *p = '_';
+    }
+    if (!(s = station(name))) return 1;
+    s->tty = tty;
+    s->fd = serial_open(tty);
+    if (s->fd < 0) {
+      perror(tty);
+      return 1;
+    }
+  }
+
+  for (i = 0; i < n_stations; i++) {
+    if (pthread_create(&stations[i].thread, NULL, poll_thread, &stations[i])) {
+      fprintf(stderr, "%s: no thread\n", stations[i].name);
+      return 1;
+    }
+  }
+  while (!stop) sleep(1);
+
+  for (i = 0; i < n_stations; i++) {
+    pthread_join(stations[i].thread, NULL);
+    tellog_close(&stations[i].log);
+  }
+  return 0;
+}